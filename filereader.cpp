@@ -1,18 +1,16 @@
 #include <wx/vector.h>
 #include <regex>
 #include <wx/string.h>
-#include <algorithm>    // for std::transform
-#include <cctype>       // for std::tolower
-#include <iterator>
-#include <fstream>
-#include <iomanip>
-#include <streambuf>
-#include <sstream>
+#include <algorithm>    // for std::min
 #include <map>
+#include <climits>
+#include <cstring>
 #include "filereader.h"
+#include "mappedfile.h"
+#include "serializer.h"
 
 
-const std::map<wxString, long> FileReader::defines = {
+const std::map<std::string, long> FileReader::defines = {
   {"WAVE_SINE", 0},
   {"WAVE_SAWTOOTH", 1},
   {"WAVE_TRIANGLE", 2},
@@ -53,31 +51,82 @@ const std::map<wxString, long> FileReader::defines = {
   {"PATCH_END", 15},
 };
 
-const std::regex FileReader::byte_line(
-  R"(^\s*\.byte\s*(.*))",
-  std::regex_constants::ECMAScript | std::regex_constants::icase
-);
-const std::regex FileReader::multiline_comments("/\\*(.|[\r\n])*?\\*/");
-const std::regex FileReader::singleline_comments("//.*");
-const std::regex FileReader::white_space("[\t\n\r]");
-const std::regex FileReader::extra_space(" +");
-const std::regex FileReader::patch_declaration(
-    "const char ([a-zA-Z_][a-zA-Z_\\d]*)\\[\\] PROGMEM ?= ?");
-const std::regex FileReader::struct_declaration(
-    "const struct PatchStruct ([a-zA-Z_][a-zA-Z_\\d]*)\\[\\] PROGMEM ?= ?");
+#define PATCH_DECLARATION "const char "
+#define STRUCT_DECLARATION "const struct PatchStruct "
 static const std::regex music_decl(
     R"(const\s+unsigned\s+char\s+([A-Za-z_][A-Za-z0-9_]*)\s*\[\]\s*=\s*\{)");
 
-long FileReader::string_to_long(const wxString &str) {
-  if (defines.find(str) != defines.end())
-    return defines.find(str)->second;
-  return strtol(str.c_str(), NULL, 0);
+static inline int digit_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A' + 10;
+  return 99;
 }
 
-bool FileReader::read_patch_vals(const wxString &str, wxVector<long> &vals) {
+/*
+ * strtol(str, NULL, 0) on a character range: leading white space, a sign,
+ * 0x and 0 prefixes for hex and octal, clamped on overflow.
+ */
+long FileReader::parse_long(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || (*p >= '\t' && *p <= '\r')))
+    p++;
+
+  bool negative = false;
+  if (p < end && (*p == '+' || *p == '-'))
+    negative = *p++ == '-';
+
+  int base = 10;
+  if (p < end && *p == '0') {
+    base = 8;
+    /* "0x" without hex digits after it is just a 0 */
+    if (end - p > 2 && (p[1] == 'x' || p[1] == 'X')
+        && digit_value(p[2]) < 16) {
+      base = 16;
+      p += 2;
+    }
+  }
+
+  unsigned long limit = negative? (unsigned long) LONG_MAX + 1 : LONG_MAX;
+  unsigned long value = 0;
+  bool overflow = false;
+  for (; p < end; p++) {
+    int digit = digit_value(*p);
+    if (digit >= base)
+      break;
+    if (value > (limit - digit) / base)
+      overflow = true;
+    else
+      value = value*base + digit;
+  }
+
+  if (overflow)
+    return negative? LONG_MIN : LONG_MAX;
+  return negative? (long) (0 - value) : (long) value;
+}
+
+long FileReader::string_to_long(const std::string &str) {
+  auto define = defines.find(str);
+  if (define != defines.end())
+    return define->second;
+  return parse_long(str.data(), str.data() + str.size());
+}
+
+/*
+ * The initializer parsers below read from right after a declaration up to
+ * its closing brace, in place. Spaces are dropped and values are split at
+ * commas at the nesting level they belong to.
+ */
+bool FileReader::read_patch_vals(const char *p, const char *end,
+    wxVector<long> &vals) {
   int depth = 0;
-  std::string vstr;
-  for (auto c : str) {
+  std::string item;
+
+  vals.clear();
+  for (; p < end; p++) {
+    char c = *p;
     if (c == '{') {
       depth++;
     }
@@ -89,28 +138,32 @@ bool FileReader::read_patch_vals(const wxString &str, wxVector<long> &vals) {
         break;
       }
     }
+    else if (c == ',' && depth == 1) {
+      if (!item.empty()) {
+        vals.push_back(string_to_long(item));
+        item.clear();
+      }
+    }
     else if (c != ' ' && depth == 1) {
-      vstr += c;
+      item += c;
     }
   }
 
-  std::stringstream ss(vstr);
-  std::string item;
-  vals.clear();
-  while (std::getline(ss, item, ',')) {
-    if (!item.empty()) {
-      vals.push_back(string_to_long(item));
-    }
+  if (!item.empty()) {
+    vals.push_back(string_to_long(item));
   }
 
   return !vals.empty();
 }
 
-bool FileReader::read_struct_vals(const wxString &str,
+bool FileReader::read_struct_vals(const char *p, const char *end,
     wxVector<wxString> &vals) {
   int depth = 0;
-  std::string vstr;
-  for (auto c : str) {
+  std::string item;
+
+  vals.clear();
+  for (; p < end; p++) {
+    char c = *p;
     if (c == '{') {
       depth++;
     }
@@ -122,83 +175,241 @@ bool FileReader::read_struct_vals(const wxString &str,
         break;
       }
       else {
-        vstr += ',';
+        /* Closing an entry ends its last value */
+        vals.push_back(item);
+        item.clear();
       }
     }
+    else if (c == ',' && depth == 2) {
+      vals.push_back(item);
+      item.clear();
+    }
     else if (c != ' ' && depth == 2) {
-      vstr += c;
+      item += c;
     }
   }
 
-  std::stringstream ss(vstr);
-  std::string item;
-  vals.clear();
-  while (std::getline(ss, item, ',')) {
+  if (!item.empty()) {
     vals.push_back(item);
   }
 
   return !vals.empty();
 }
 
-std::string FileReader::clean_code(const std::string &code) {
-  std::string clean_code, t;
-
-  /* Remove comments and unecessary white space */
-  std::regex_replace(std::back_inserter(clean_code), code.begin(), code.end(),
-      multiline_comments, "");
-  clean_code.swap(t);
-  clean_code.clear();
-  std::regex_replace(std::back_inserter(clean_code), t.begin(), t.end(),
-      singleline_comments, "");
-  clean_code.swap(t);
-  clean_code.clear();
-  std::regex_replace(std::back_inserter(clean_code), t.begin(), t.end(),
-      white_space, " ");
-  clean_code.swap(t);
-  clean_code.clear();
-  std::regex_replace(std::back_inserter(clean_code), t.begin(), t.end(),
-      extra_space, " ");
+static inline bool is_name_start(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static inline bool is_name_char(char c) {
+  return is_name_start(c) || (c >= '0' && c <= '9');
+}
+
+/*
+ * Finds the next "<prefix>NAME[] PROGMEM = " in cleaned code, the spaces
+ * around '=' being optional. Returns where the initializer starts, or
+ * nullptr when there are no more declarations.
+ */
+const char *FileReader::find_declaration(const char *p, const char *end,
+    const char *prefix, std::string &name) {
+  static const char suffix[] = "[] PROGMEM";
+  const size_t prefix_len = strlen(prefix);
+  const size_t suffix_len = sizeof(suffix) - 1;
+
+  for (; (size_t) (end - p) >= prefix_len; p++) {
+    p = (const char *) memchr(p, prefix[0], end - p);
+    if (!p || (size_t) (end - p) < prefix_len) {
+      break;
+    }
+    if (memcmp(p, prefix, prefix_len)) {
+      continue;
+    }
+
+    const char *q = p + prefix_len;
+    if (q == end || !is_name_start(*q)) {
+      continue;
+    }
+    const char *name_start = q;
+    while (q < end && is_name_char(*q)) {
+      q++;
+    }
+    const char *name_end = q;
+
+    if ((size_t) (end - q) < suffix_len || memcmp(q, suffix, suffix_len)) {
+      continue;
+    }
+    q += suffix_len;
+    if (q < end && *q == ' ') {
+      q++;
+    }
+    if (q == end || *q != '=') {
+      continue;
+    }
+    q++;
+    if (q < end && *q == ' ') {
+      q++;
+    }
+
+    name.assign(name_start, name_end);
+    return q;
+  }
+
+  return nullptr;
+}
+
+/*
+ * Calls f with every character of code that isn't part of a block comment.
+ * An unterminated comment is kept as is.
+ */
+template <typename F>
+static void skip_block_comments(const char *p, const char *end, F f) {
+  while (p < end) {
+    if (*p == '/' && p+1 < end && p[1] == '*') {
+      const char *close = p+2;
+      while (close+1 < end && !(close[0] == '*' && close[1] == '/')) {
+        close++;
+      }
+      if (close+1 >= end) {
+        break;
+      }
+      p = close + 2;
+    }
+    else {
+      f(*p++);
+    }
+  }
+
+  for (; p < end; p++) {
+    f(*p);
+  }
+}
+
+std::string FileReader::remove_block_comments(const char *p,
+    const char *end) {
+  std::string clean_code;
+
+  clean_code.reserve(end - p);
+  skip_block_comments(p, end, [&] (char c) { clean_code += c; });
+
+  return clean_code;
+}
+
+/*
+ * Removes comments and unecessary white space in a single pass. The output
+ * is the same as removing block comments, then line comments, then turning
+ * tabs and line breaks into spaces and squeezing runs of spaces, in that
+ * order: a line comment can start with a '/' left before a block comment.
+ */
+std::string FileReader::clean_code(const char *p, const char *end) {
+  std::string clean_code;
+  bool slash = false;
+  bool line_comment = false;
+
+  clean_code.reserve(end - p);
+
+  auto put = [&] (char c) {
+    if (c == '\t' || c == '\n' || c == '\r') {
+      c = ' ';
+    }
+    if (c != ' ' || clean_code.empty() || clean_code.back() != ' ') {
+      clean_code += c;
+    }
+  };
+
+  skip_block_comments(p, end, [&] (char c) {
+    if (line_comment) {
+      if (c != '\n' && c != '\r') {
+        return;
+      }
+      line_comment = false;
+    }
+    else if (slash) {
+      /* Held back in case it started a line comment */
+      slash = false;
+      if (c == '/') {
+        line_comment = true;
+        return;
+      }
+      put('/');
+    }
+    else if (c == '/') {
+      slash = true;
+      return;
+    }
+    put(c);
+  });
+
+  if (slash) {
+    put('/');
+  }
 
   return clean_code;
 }
 
 bool FileReader::read_patches(const std::string &clean_src,
     std::multimap<wxString, wxVector<long>> &data) {
-  std::smatch match;
-  auto search_start = clean_src.cbegin();
+  const char *p = clean_src.data();
+  const char *end = p + clean_src.size();
+  std::string name;
 
   data.clear();
 
-  while (std::regex_search(search_start, clean_src.cend(),
-        match, patch_declaration)) {
-    search_start += match.position() + match.length();
-
+  while ((p = find_declaration(p, end, PATCH_DECLARATION, name))) {
     wxVector<long> vals;
-    std::string varea(search_start, clean_src.cend());
-    if (!read_patch_vals(varea, vals))
+    if (!read_patch_vals(p, end, vals))
       return false;
-    data.emplace(match[1].str(), vals);
+    data.emplace(name, vals);
   }
 
   return true;
 }
 
+bool FileReader::patch_commands(const wxVector<long> &vals,
+    wxVector<PatchCommand> &commands) {
+  bool as_written = true;
+
+  commands.clear();
+  commands.reserve((vals.size() + 2)/3);
+
+  for (size_t i = 0; i < vals.size(); i += 3) {
+    if (i+1 >= vals.size()) {
+      return false;
+    }
+    /* Anything past PATCH_END is taken as PATCH_END */
+    long command = std::min(15l, (long) vals[i+1]);
+    /* PATCH_END might not have a parameter */
+    if (i+2 >= vals.size() && command != 15) {
+      return false;
+    }
+    long param = i+2 >= vals.size()? 0 : vals[i+2];
+    PatchCommand c;
+
+    if (!PatchCommand::pack(vals[i], command, param, c)) {
+      /* Clamped rather than losing the patch, the grid shows parameters
+       * still out of range for the command in red */
+      PatchCommand::pack(std::max(0l, std::min((long) UINT8_MAX, vals[i])),
+          std::max(0l, command), std::max((long) INT16_MIN,
+            std::min((long) INT16_MAX, param)), c);
+      as_written = false;
+    }
+    commands.push_back(c);
+  }
+
+  return as_written;
+}
+
 bool FileReader::read_structs(const std::string &clean_src,
     std::multimap<wxString, wxVector<wxString>> &data) {
-  std::smatch match;
-  auto search_start = clean_src.cbegin();
+  const char *p = clean_src.data();
+  const char *end = p + clean_src.size();
+  std::string name;
 
   data.clear();
 
-  while (std::regex_search(search_start, clean_src.cend(),
-        match, struct_declaration)) {
-    search_start += match.position() + match.length();
-
+  while ((p = find_declaration(p, end, STRUCT_DECLARATION, name))) {
     wxVector<wxString> vals;
-    std::string varea(search_start, clean_src.cend());
-    if (!read_struct_vals(varea, vals))
+    if (!read_struct_vals(p, end, vals))
       return false;
-    data.emplace(match[1].str(), vals);
+    data.emplace(name, vals);
   }
 
   return true;
@@ -207,145 +418,191 @@ bool FileReader::read_structs(const std::string &clean_src,
 bool FileReader::read_patches_and_structs(const wxString &fn,
     std::multimap<wxString, wxVector<long>> &patches,
     std::multimap<wxString, wxVector<wxString>> &structs) {
-  std::ifstream f(fn);
-  if (!f.is_open())
+  MappedFile file;
+  if (!file.open(fn))
     return false;
-  std::string src((std::istreambuf_iterator<char>(f)),
-    std::istreambuf_iterator<char>());
-  std::string clean_src = clean_code(src);
+  /* Unmapped before parsing, the clean copy is all that's needed */
+  std::string clean_src = clean_code(file.begin(), file.end());
+  file.close();
 
   return read_patches(clean_src, patches) && read_structs(clean_src, structs);
 }
 
+bool FileReader::read_patches_and_structs(const char *begin,
+    const char *end, std::multimap<wxString, wxVector<long>> &patches,
+    std::multimap<wxString, wxVector<wxString>> &structs) {
+  std::string clean_src = clean_code(begin, end);
+
+  return read_patches(clean_src, patches) && read_structs(clean_src, structs);
+}
+
+
+/*
+ * Wave banks: WAVE_BANK_MAGIC, a version byte, the number of waves, the wave
+ * size as 16 bits little endian, then the waves as they are held in memory.
+ */
+#define WAVE_BANK_MAGIC "UZEWAVES"
+#define WAVE_BANK_MAGIC_LEN 8
+#define WAVE_BANK_VERSION 1
+#define WAVE_BANK_HEADER_LEN 12
+
+bool FileReader::is_wave_bank(const char *p, const char *end) {
+  return end - p >= WAVE_BANK_HEADER_LEN
+    && memcmp(p, WAVE_BANK_MAGIC, WAVE_BANK_MAGIC_LEN) == 0;
+}
+
+size_t FileReader::read_wave_bank(const char *p, const char *end,
+    WaveTable waves[], size_t maxWaves) {
+  const uint8_t *header = (const uint8_t *) p + WAVE_BANK_MAGIC_LEN;
+  size_t count = header[1];
+  size_t wave_size = header[2] | header[3] << 8;
+
+  if (header[0] != WAVE_BANK_VERSION || wave_size != WAVE_SIZE
+      || count > MAX_WAVES
+      || (size_t) (end - p) < WAVE_BANK_HEADER_LEN + count*WAVE_SIZE)
+    return 0;
+
+  count = std::min(count, maxWaves);
+  p += WAVE_BANK_HEADER_LEN;
+  for (size_t i = 0; i < count; i++, p += WAVE_SIZE) {
+    memcpy(waves[i].data(), p, WAVE_SIZE);
+  }
+
+  return count;
+}
+
+/*
+ * Reads the values of `.byte` lines, case insensitive, up to a ';' comment.
+ * Values are C integer literals taken as two's complement bytes. A value
+ * that isn't a number ends the waves, keeping the ones read in full.
+ */
+size_t FileReader::read_byte_directives(const char *p, const char *end,
+    WaveTable waves[], size_t maxWaves) {
+  /* Waves are only stored once complete */
+  WaveTable buffer;
+  size_t wave = 0, sample = 0;
+
+  while (p < end && wave < maxWaves) {
+    const char *line_end = (const char *) memchr(p, '\n', end - p);
+    if (!line_end)
+      line_end = end;
+    const char *semi = (const char *) memchr(p, ';', line_end - p);
+    const char *q = p, *stop = semi? semi : line_end;
+    p = line_end + 1;
+
+    while (q < stop && (*q == ' ' || *q == '\t'))
+      q++;
+    if (stop - q < 5 || q[0] != '.' || (q[1] | 0x20) != 'b'
+        || (q[2] | 0x20) != 'y' || (q[3] | 0x20) != 't'
+        || (q[4] | 0x20) != 'e')
+      continue;
+
+    for (q += 5; q < stop && wave < maxWaves; q++) {
+      const char *comma = (const char *) memchr(q, ',', stop - q);
+      const char *token_end = comma? comma : stop;
+      /* A line break left as the last character is not part of the value */
+      if (!comma && !semi && token_end > q && token_end[-1] == '\r')
+        token_end--;
+
+      while (q < token_end && (*q == ' ' || *q == '\t'))
+        q++;
+      if (q < token_end) {
+        const char *digits = q;
+        while (digits < token_end
+            && (*digits == ' ' || (*digits >= '\t' && *digits <= '\r')))
+          digits++;
+        if (digits < token_end && (*digits == '+' || *digits == '-'))
+          digits++;
+        if (digits == token_end || *digits < '0' || *digits > '9')
+          return wave;
+
+        int8_t value = (int8_t) (parse_long(q, token_end) & 0xFF);
+        buffer[sample++] = (uint8_t) (value + 128);
+        if (sample == WAVE_SIZE) {
+          waves[wave++] = buffer;
+          sample = 0;
+        }
+      }
+      q = token_end;
+    }
+  }
+
+  return wave;
+}
 
 size_t FileReader::read_waves(const wxString &fn,
                               WaveTable waves[],
                               size_t maxWaves)
 {
-  // 1) Slurp entire file into a string
-  std::ifstream in(fn.mb_str(), std::ios::in | std::ios::binary);
-  if (!in.is_open()) return 0;
-  std::string src((std::istreambuf_iterator<char>(in)),
-                   std::istreambuf_iterator<char>());
+  MappedFile in;
+  if (!in.open(fn)) return 0;
+
+  if (is_wave_bank(in.begin(), in.end()))
+    return read_wave_bank(in.begin(), in.end(), waves, maxWaves);
+
+  std::string src = remove_block_comments(in.begin(), in.end());
   in.close();
 
-  // 2) Strip out all C-style /* … */ blocks
-  src = std::regex_replace(src, multiline_comments, "");
-
-  // 3) Split into lines (handling both \r\n and \n)
-  std::vector<std::string> lines;
-  {
-    std::istringstream iss(src);
-    std::string line;
-    while (std::getline(iss, line)) {
-      if (!line.empty() && line.back() == '\r')
-        line.pop_back();
-      lines.push_back(std::move(line));
-    }
-  }
+  return read_byte_directives(src.data(), src.data() + src.size(), waves,
+      maxWaves);
+}
 
-  size_t waveIdx = 0;
-  std::vector<uint8_t> buffer;
-  buffer.reserve(WAVE_SIZE);
-
-  // 4) Scan each line for “.byte” directives
-  for (const auto &raw : lines) {
-    if (waveIdx >= maxWaves) break;
-
-    // 4a) Chop off any trailing ';' comment
-    auto semi = raw.find(';');
-    std::string line = (semi == std::string::npos
-                        ? raw
-                        : raw.substr(0, semi));
-
-    // 4b) Trim leading whitespace
-    auto first = line.find_first_not_of(" \t");
-    if (first == std::string::npos) continue;
-    line.erase(0, first);
-
-    // 4c) Case-insensitive check for ".byte"
-    if (line.size() < 5) continue;
-    std::string prefix = line.substr(0,5);
-    std::transform(prefix.begin(), prefix.end(), prefix.begin(),
-                   [](unsigned char c){ return std::tolower(c); });
-    if (prefix != ".byte") continue;
-
-    // 4d) Parse the comma-separated literals
-    std::string nums = line.substr(5);
-    std::istringstream ss(nums);
-    std::string tok;
-    while (std::getline(ss, tok, ',')) {
-      // trim whitespace around tok
-      auto a = tok.find_first_not_of(" \t");
-      auto b = tok.find_last_not_of(" \t");
-      if (a == std::string::npos) continue;
-      tok = tok.substr(a, b - a + 1);
-
-      // interpret as signed 8-bit, then shift to unsigned 0–255
-      long  rawVal      = std::stol(tok, nullptr, 0);
-      int8_t signedSample = static_cast<int8_t>(rawVal & 0xFF);
-      uint8_t u           = static_cast<uint8_t>(int(signedSample) + 128);
-
-      buffer.push_back(u);
-
-      // once we have WAVE_SIZE samples, commit one wave
-      if (buffer.size() == WAVE_SIZE) {
-        std::copy(buffer.begin(), buffer.end(),
-                  waves[waveIdx].begin());
-        buffer.clear();
-        ++waveIdx;
-        if (waveIdx >= maxWaves) break;
-      }
-    }
+bool FileReader::write_wave_bank(const wxString &fn,
+                                 WaveTable waves[],
+                                 size_t numWaves)
+{
+  numWaves = std::min(numWaves, (size_t) MAX_WAVES);
+  Serializer out;
+  out.reserve(WAVE_BANK_HEADER_LEN + numWaves*WAVE_SIZE);
+
+  char header[WAVE_BANK_HEADER_LEN] = WAVE_BANK_MAGIC;
+  header[WAVE_BANK_MAGIC_LEN] = WAVE_BANK_VERSION;
+  header[WAVE_BANK_MAGIC_LEN + 1] = (char) numWaves;
+  header[WAVE_BANK_MAGIC_LEN + 2] = WAVE_SIZE & 0xFF;
+  header[WAVE_BANK_MAGIC_LEN + 3] = WAVE_SIZE >> 8;
+  out.bytes(header, WAVE_BANK_HEADER_LEN);
+
+  for (size_t w = 0; w < numWaves; ++w) {
+    out.bytes(waves[w].data(), WAVE_SIZE);
   }
 
-  return waveIdx;
+  return out.write(fn);
 }
 
 bool FileReader::write_waves(const wxString &fn,
                              WaveTable waves[],
                              size_t numWaves)
 {
-  std::ofstream out(fn.mb_str(), std::ios::out | std::ios::binary);
-  if (!out.is_open()) return false;
+  Serializer out;
+  // About 6 bytes per sample plus the line prefixes
+  out.reserve(64 + numWaves*(WAVE_SIZE*6 + 200));
 
   // Header comment
   out << "/* Created by Uzebox Patch Studio: wavetable export */\n\n";
 
   for (size_t w = 0; w < numWaves; ++w) {
     // Comment for each wave
-    out << "; Wave #" << w << "\n";
+    out << "; Wave #" << (unsigned long) w << '\n';
 
     // We break each wave into lines of 16 bytes
     for (size_t i = 0; i < WAVE_SIZE; i += 16) {
       out << "  .byte ";
 
       for (size_t j = 0; j < 16 && (i + j) < WAVE_SIZE; ++j) {
-        // Invert your loader’s signed→unsigned shift:
-        // waves[w][i+j] is 0…255, but the loader expects two’s-complement bytes.
-        uint8_t u      = waves[w][i + j];
-        int8_t  s      = static_cast<int8_t>(int(u) - 128);
-        uint8_t rawVal = static_cast<uint8_t>(s);
-
-        // Emit as hex literal 0xNN
-        out << "0x"
-            << std::uppercase
-            << std::hex
-            << std::setw(2)
-            << std::setfill('0')
-            << int(rawVal);
+        // Invert the loader's signed->unsigned shift:
+        // waves[w][i+j] is 0…255, but the loader expects two's-complement bytes.
+        out.hex_byte((uint8_t) (waves[w][i + j] - 128));
 
         // comma if not last in line
         if (j + 1 < 16 && (i + j + 1) < WAVE_SIZE)
-          out << ",";
+          out << ',';
       }
 
-      out << "\n";
+      out << '\n';
     }
 
-    out << "\n";
+    out << '\n';
   }
 
-  out.close();
-  return true;
+  return out.write(fn);
 }
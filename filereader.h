@@ -3,18 +3,26 @@
 #include <wx/string.h>
 #include <wx/vector.h>
 #include <map>
-#include <regex>
+#include "patchcommand.h"
 #include "waves.h"    // defines WaveTable, WAVE_SIZE, NUM_WAVES
 
+/// File extension the editor saves wave banks with
+#define WAVE_BANK_EXTENSION "uwb"
+
 class FileReader {
 public:
     /// Parse a patches.inc/.cpp and extract patches & structs
     static bool read_patches_and_structs(const wxString &fn,
         std::multimap<wxString, wxVector<long>> &patches,
         std::multimap<wxString, wxVector<wxString>> &structs);
+    /// Same, over source already in memory
+    static bool read_patches_and_structs(const char *begin, const char *end,
+        std::multimap<wxString, wxVector<long>> &patches,
+        std::multimap<wxString, wxVector<wxString>> &structs);
 
     /// Read up to `maxWaves` tables (each WAVE_SIZE bytes) from a `.inc`-style
-    /// wavetable file into `waves[0..]`.  Returns how many full tables loaded.
+    /// wavetable file, or a wave bank, into `waves[0..]`.  Returns how many
+    /// full tables loaded.
     static size_t read_waves(const wxString &fn,
                              WaveTable waves[],
                              size_t maxWaves = MAX_WAVES);
@@ -23,22 +31,37 @@ public:
     static bool write_waves(const wxString &fn,
                             WaveTable waves[],
                             size_t numWaves);
+    /// Write out `numWaves` tables as a binary wave bank, which loads much
+    /// faster than source.  Returns true on success.
+    static bool write_wave_bank(const wxString &fn,
+                                WaveTable waves[],
+                                size_t numWaves);
+    /// Turn the values of a patch as read from a file into the commands the
+    /// editor works with.  PATCH_END may lack its parameter.  A value no
+    /// patch array could hold is clamped to the nearest one that fits, and
+    /// a last command missing values is left out; false if either happened.
+    static bool patch_commands(const wxVector<long> &vals,
+        wxVector<PatchCommand> &commands);
 private:
-    static long string_to_long(const wxString &str);
-    static bool read_patch_vals(const wxString &str, wxVector<long> &vals);
-    static bool read_struct_vals(const wxString &str, wxVector<wxString> &vals);
-    static std::string clean_code(const std::string &code);
+    static long parse_long(const char *p, const char *end);
+    static long string_to_long(const std::string &str);
+    static bool read_patch_vals(const char *p, const char *end,
+        wxVector<long> &vals);
+    static bool read_struct_vals(const char *p, const char *end,
+        wxVector<wxString> &vals);
+    static const char *find_declaration(const char *p, const char *end,
+        const char *prefix, std::string &name);
+    static std::string clean_code(const char *p, const char *end);
+    static std::string remove_block_comments(const char *p, const char *end);
+    static bool is_wave_bank(const char *p, const char *end);
+    static size_t read_wave_bank(const char *p, const char *end,
+        WaveTable waves[], size_t maxWaves);
+    static size_t read_byte_directives(const char *p, const char *end,
+        WaveTable waves[], size_t maxWaves);
     static bool read_patches(const std::string &clean_src,
         std::multimap<wxString, wxVector<long>> &data);
     static bool read_structs(const std::string &clean_src,
         std::multimap<wxString, wxVector<wxString>> &data);
 
-    static const std::map<wxString, long> defines;
-    static const std::regex byte_line;
-    static const std::regex multiline_comments;
-    static const std::regex singleline_comments;
-    static const std::regex white_space;
-    static const std::regex extra_space;
-    static const std::regex patch_declaration;
-    static const std::regex struct_declaration;
+    static const std::map<std::string, long> defines;
 };
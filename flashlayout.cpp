@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <map>
+#include <numeric>
+#include <tuple>
+#include <vector>
+#include "flashlayout.h"
+
+wxVector<uint8_t> patch_flash_bytes(const wxVector<PatchCommand> &data) {
+  wxVector<uint8_t> bytes;
+
+  if (data.empty()) {
+    bytes.push_back(0);
+    bytes.push_back(15);
+  }
+  for (size_t i = 0; i < data.size(); i++) {
+    bytes.push_back(data[i].delay);
+    if (data[i].command >= 15) {
+      bytes.push_back(15);
+      /* The last PATCH_END goes without its parameter */
+      if (i+1 < data.size()) {
+        bytes.push_back(data[i].param);
+      }
+    }
+    else {
+      bytes.push_back(data[i].command);
+      bytes.push_back(data[i].param);
+    }
+  }
+
+  return bytes;
+}
+
+/*
+ * Sorting the items by their reversed contents puts every item right
+ * before the items it is a tail of, so each one only needs comparing with
+ * the next. Identical items sort by falling index, so the first one of them
+ * keeps the array.
+ */
+template <typename T>
+static wxVector<FlashAlias> share_tails(
+    const std::vector<std::vector<T>> &items) {
+  size_t n = items.size();
+  wxVector<FlashAlias> aliases;
+  std::vector<size_t> order(n);
+
+  for (size_t i = 0; i < n; i++) {
+    aliases.push_back({i, 0});
+  }
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&] (size_t a, size_t b) {
+    auto &x = items[a], &y = items[b];
+    if (std::lexicographical_compare(x.rbegin(), x.rend(), y.rbegin(),
+          y.rend()))
+      return true;
+    if (std::lexicographical_compare(y.rbegin(), y.rend(), x.rbegin(),
+          x.rend()))
+      return false;
+    return a > b;
+  });
+
+  /* From the back, so the item a tail lives in is placed already */
+  for (size_t k = n; k-- > 1;) {
+    size_t tail = order[k-1], item = order[k];
+    auto &x = items[tail], &y = items[item];
+    if (x.size() <= y.size() && std::equal(x.rbegin(), x.rend(), y.rbegin())) {
+      aliases[tail].base = aliases[item].base;
+      aliases[tail].offset = aliases[item].offset + y.size() - x.size();
+    }
+  }
+
+  return aliases;
+}
+
+FlashLayout plan_flash_layout(const Project &project) {
+  FlashLayout layout;
+  std::vector<std::vector<uint8_t>> patches;
+  /* Type, pcm, patch array and offset or unknown patch, loop points */
+  typedef std::tuple<uint8_t, Symbol, size_t, size_t, Symbol, int32_t,
+          int32_t> RowKey;
+  std::vector<std::vector<RowKey>> structs;
+
+  for (auto &patch : project.patches) {
+    auto bytes = patch_flash_bytes(patch.data);
+    patches.emplace_back(bytes.begin(), bytes.end());
+  }
+  layout.patches = share_tails(patches);
+
+  /* Structs pointing to shared patches point to the same bytes */
+  std::map<Symbol, FlashAlias> patch_location;
+  for (size_t i = 0; i < project.patches.size(); i++) {
+    /* Patches no struct refers to were never interned */
+    Symbol name = patch_symbols.find(project.patches[i].name);
+    if (name != NO_SYMBOL) {
+      patch_location[name] = layout.patches[i];
+    }
+  }
+
+  auto row_key = [&] (const StructRow &row) {
+    Symbol patch = patch_symbols.resolve(row.patch);
+    auto location = patch_location.find(patch);
+    if (location != patch_location.end()) {
+      return RowKey(row.type, row.pcm, location->second.base,
+          location->second.offset, NO_SYMBOL, row.loop_start, row.loop_end);
+    }
+    return RowKey(row.type, row.pcm, SIZE_MAX, SIZE_MAX, patch,
+        row.loop_start, row.loop_end);
+  };
+
+  for (auto &s : project.structs) {
+    std::vector<RowKey> rows;
+    for (auto &row : s.data) {
+      rows.push_back(row_key(row));
+    }
+    if (rows.empty()) {
+      rows.push_back(row_key(StructRow::empty()));
+    }
+    structs.push_back(rows);
+  }
+  layout.structs = share_tails(structs);
+
+  layout.shared_patches = layout.shared_structs = 0;
+  layout.bytes_before = layout.bytes_after = 0;
+  for (size_t i = 0; i < patches.size(); i++) {
+    layout.bytes_before += patches[i].size();
+    if (layout.patches[i].base == i) {
+      layout.bytes_after += patches[i].size();
+    }
+    else {
+      layout.shared_patches++;
+    }
+  }
+  for (size_t i = 0; i < structs.size(); i++) {
+    layout.bytes_before += structs[i].size()*PATCH_STRUCT_BYTES;
+    if (layout.structs[i].base == i) {
+      layout.bytes_after += structs[i].size()*PATCH_STRUCT_BYTES;
+    }
+    else {
+      layout.shared_structs++;
+    }
+  }
+
+  return layout;
+}
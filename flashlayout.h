@@ -0,0 +1,39 @@
+#pragma once
+
+#include <wx/string.h>
+#include <wx/vector.h>
+#include <cstdint>
+#include "projectfile.h"
+
+/* sizeof(struct PatchStruct) on the console: a type byte and four 16 bit
+ * pointers and loop points */
+#define PATCH_STRUCT_BYTES 9
+
+/*
+ * Where a patch or struct ends up in flash: in its own array, or inside the
+ * array of another one it is identical to or a tail of.
+ */
+struct FlashAlias {
+  size_t base;      /* Index of the array it lives in, its own if unshared */
+  size_t offset;    /* Into that array, in bytes for patches, rows for structs */
+};
+
+struct FlashLayout {
+  wxVector<FlashAlias> patches;
+  wxVector<FlashAlias> structs;
+  size_t shared_patches;
+  size_t shared_structs;
+  /* PROGMEM taken by patches and structs with an array each, and shared */
+  size_t bytes_before;
+  size_t bytes_after;
+};
+
+/* The bytes of a patch as the editor saves it */
+wxVector<uint8_t> patch_flash_bytes(const wxVector<PatchCommand> &data);
+
+/*
+ * Finds the patches that are byte for byte the same as, or a tail of,
+ * another one, and the structs that are the same as or a tail of another
+ * once their patches are shared.
+ */
+FlashLayout plan_flash_layout(const Project &project);
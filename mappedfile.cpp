@@ -0,0 +1,139 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cstdint>
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <cerrno>
+#include <unistd.h>
+#endif
+#include "mappedfile.h"
+
+#define READ_CHUNK (64*1024)
+
+#ifdef _WIN32
+typedef struct _stat64 Stat;
+
+static int open_file(const wxString &fn) {
+  return _wopen(fn.wc_str(), _O_RDONLY | _O_BINARY);
+}
+
+static int stat_file(int fd, Stat *st) {
+  return _fstat64(fd, st);
+}
+
+static const char *map_file(int fd, size_t length) {
+  HANDLE file = (HANDLE) _get_osfhandle(fd);
+  HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!mapping) {
+    return nullptr;
+  }
+
+  void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, length);
+  /* The view keeps the mapping alive */
+  CloseHandle(mapping);
+
+  return (const char *) view;
+}
+
+static void unmap_file(const char *map, size_t) {
+  UnmapViewOfFile(map);
+}
+
+static long read_file(int fd, char *buf, size_t count) {
+  return _read(fd, buf, (unsigned) count);
+}
+
+static void close_file(int fd) {
+  _close(fd);
+}
+#else
+typedef struct stat Stat;
+
+static int open_file(const wxString &fn) {
+  return ::open(fn.fn_str(), O_RDONLY);
+}
+
+static int stat_file(int fd, Stat *st) {
+  return fstat(fd, st);
+}
+
+static const char *map_file(int fd, size_t length) {
+  void *map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    return nullptr;
+  }
+  /* Parsers go through the file once, front to back */
+  madvise(map, length, MADV_SEQUENTIAL);
+
+  return (const char *) map;
+}
+
+static void unmap_file(const char *map, size_t length) {
+  munmap((void *) map, length);
+}
+
+static long read_file(int fd, char *buf, size_t count) {
+  ssize_t got;
+
+  do {
+    got = ::read(fd, buf, count);
+  } while (got < 0 && errno == EINTR);
+
+  return got;
+}
+
+static void close_file(int fd) {
+  ::close(fd);
+}
+#endif
+
+bool MappedFile::open(const wxString &fn) {
+  close();
+
+  int fd = open_file(fn);
+  if (fd < 0) {
+    return false;
+  }
+
+  Stat st;
+  bool ok = stat_file(fd, &st) == 0;
+  if (ok && (st.st_mode & S_IFMT) == S_IFREG && st.st_size > 0
+      && (uint64_t) st.st_size <= SIZE_MAX) {
+    length = st.st_size;
+    map = map_file(fd, length);
+  }
+  /* Empty files can't be mapped, and pipes have no size to map */
+  if (ok && !map) {
+    length = 0;
+    ok = read_all(fd);
+  }
+  close_file(fd);
+
+  return ok;
+}
+
+void MappedFile::close() {
+  if (map) {
+    unmap_file(map, length);
+    map = nullptr;
+  }
+  length = 0;
+  buffer.clear();
+}
+
+bool MappedFile::read_all(int fd) {
+  for (;;) {
+    size_t used = buffer.size();
+    buffer.resize(used + READ_CHUNK);
+
+    long got = read_file(fd, &buffer[used], READ_CHUNK);
+    if (got <= 0) {
+      buffer.resize(used);
+      return got == 0;
+    }
+    buffer.resize(used + got);
+  }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <wx/string.h>
+#include <string>
+
+/*
+ * Read only view of a whole file. Regular files are mapped into memory so
+ * parsers can work straight over the page cache; anything else (pipes,
+ * devices) or a failed mapping falls back to reading into a buffer.
+ */
+class MappedFile {
+  public:
+    MappedFile() : map(nullptr), length(0) {}
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(const wxString &fn);
+    void close();
+
+    const char *begin() const { return map? map : buffer.data(); }
+    const char *end() const { return begin() + size(); }
+    size_t size() const { return map? length : buffer.size(); }
+
+  private:
+    const char *map;
+    size_t length;
+    std::string buffer;
+
+    bool read_all(int fd);
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * One command of a patch as the editor holds it. Delays and commands are a
+ * byte on the console too. Parameters are stored in bytes there, but they're
+ * held signed and wider here so negative note changes and out-of-range values
+ * the compiler reports on still fit.
+ */
+struct PatchCommand {
+  uint8_t delay;
+  uint8_t command;
+  int16_t param;
+
+  /*
+   * Fails if a value doesn't fit. Values that don't can't be in a patch
+   * array of the console either, so data is checked with this where it
+   * enters the editor.
+   */
+  static bool pack(long delay, long command, long param, PatchCommand &out) {
+    if (delay < 0 || delay > UINT8_MAX || command < 0 || command > UINT8_MAX
+        || param < INT16_MIN || param > INT16_MAX) {
+      return false;
+    }
+    out = {(uint8_t) delay, (uint8_t) command, (int16_t) param};
+    return true;
+  }
+
+  bool operator==(const PatchCommand &other) const {
+    return delay == other.delay && command == other.command
+      && param == other.param;
+  }
+  bool operator!=(const PatchCommand &other) const {
+    return !(*this == other);
+  }
+};
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <cstdlib>
+#include "flashlayout.h"
+#include "patchcost.h"
+#include "patchprogram.h"
+#include "step_table.h"
+
+/*
+ * Rough cycle counts of the kernel's ProcessMusic() built with -Os, per
+ * voice. They are estimates read off the generated code, good for comparing
+ * patches and spotting frames that run many commands, not cycle exact.
+ */
+
+/* Envelope, delay counter and final volume, every frame */
+#define FRAME_CYCLES 40
+/* Reading a command and its parameter and the indirect call */
+#define COMMAND_CYCLES 45
+/* Extra cycles of a frame with a slide or tremolo going on */
+#define SLIDE_FRAME_CYCLES 50
+#define TREMOLO_FRAME_CYCLES 60
+
+/* What each command's handler adds to COMMAND_CYCLES, PATCH_END last */
+static const unsigned handler_cycles[] = {
+  8,    /* PC_ENV_SPEED */
+  10,   /* PC_NOISE_PARAMS */
+  20,   /* PC_WAVE */
+  60,   /* PC_NOTE_UP */
+  60,   /* PC_NOTE_DOWN */
+  10,   /* PC_NOTE_CUT */
+  4,    /* PC_NOTE_HOLD */
+  8,    /* PC_ENV_VOL */
+  60,   /* PC_PITCH */
+  8,    /* PC_TREMOLO_LEVEL */
+  8,    /* PC_TREMOLO_RATE */
+  120,  /* PC_SLIDE, divides */
+  8,    /* PC_SLIDE_SPEED */
+  12,   /* PC_LOOP_START */
+  20,   /* PC_LOOP_END */
+  10,   /* PATCH_END */
+};
+
+static unsigned command_cycles(uint8_t command) {
+  return COMMAND_CYCLES
+    + handler_cycles[std::min((unsigned) command, (unsigned) PC_LOOP_END+1)];
+}
+
+bool estimate_patch_cost(const wxVector<PatchCommand> &data,
+    PatchCost &cost, wxString &error) {
+  PatchProgram program;
+  if (!program.compile(data)) {
+    error = program.last_error;
+    return false;
+  }
+
+  auto &events = program.get_events();
+  size_t frames = program.samples()/SAMPLES_PER_FRAME;
+  /* Commands after the last delay run on the frame after the last one */
+  wxVector<unsigned long> cycles(frames + 1, FRAME_CYCLES);
+  wxVector<size_t> commands(frames + 1, 0);
+
+  cost = {patch_flash_bytes(data).size(), frames, 0, 0, 0, 0};
+
+  /* Slides and tremolo cost from the frame they start on */
+  auto add_cycles = [&] (size_t from, size_t to, unsigned long per_frame) {
+    for (size_t f = from; f < std::min(to, frames + 1); f++) {
+      cycles[f] += per_frame;
+    }
+  };
+
+  size_t frame = 0, slide_from = 0, slide_end = 0, tremolo_from = 0;
+  bool tremolo = false;
+  int step = step_table[80];
+  for (size_t i = 0; i < events.size(); i++) {
+    auto &event = events[i];
+    frame += event.frames;
+
+    /* After PATCH_END the player only fades the voice out */
+    if (i && event.command == PATCH_END
+        && events[i-1].command == PATCH_END) {
+      break;
+    }
+
+    cycles[frame] += command_cycles(event.command);
+    commands[frame]++;
+    cost.commands++;
+
+    switch (event.command) {
+      case PC_NOTE_UP:
+      case PC_NOTE_DOWN:
+      case PC_PITCH:
+        /* Setting a note stops a slide */
+        add_cycles(slide_from, std::min(slide_end, frame), SLIDE_FRAME_CYCLES);
+        slide_from = slide_end = 0;
+        step = event.value;
+        break;
+
+      case PC_SLIDE: {
+        add_cycles(slide_from, std::min(slide_end, frame), SLIDE_FRAME_CYCLES);
+        int target = step_table[(int) event.note];
+        int speed = std::abs(event.value);
+        slide_from = frame;
+        slide_end = frame + std::max(1, (std::abs(target - step) + speed - 1)
+            / speed);
+        step = target;
+        break;
+      }
+
+      case PC_TREMOLO_LEVEL:
+        if (event.value && !tremolo) {
+          tremolo_from = frame;
+        }
+        else if (!event.value && tremolo) {
+          add_cycles(tremolo_from, frame, TREMOLO_FRAME_CYCLES);
+        }
+        tremolo = event.value;
+        break;
+    }
+  }
+
+  add_cycles(slide_from, slide_end, SLIDE_FRAME_CYCLES);
+  if (tremolo) {
+    add_cycles(tremolo_from, frames + 1, TREMOLO_FRAME_CYCLES);
+  }
+
+  /* The frame after the last one only counts if commands run on it */
+  size_t counted = frames + (commands[frames] ? 1 : 0);
+  for (size_t f = 0; f < counted; f++) {
+    cost.total_cycles += cycles[f];
+    cost.peak_cycles = std::max(cost.peak_cycles, cycles[f]);
+    cost.peak_commands = std::max(cost.peak_commands, commands[f]);
+  }
+
+  return true;
+}
+
+size_t struct_flash_bytes(const wxVector<StructRow> &data) {
+  return data.size()*PATCH_STRUCT_BYTES;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <wx/string.h>
+#include <wx/vector.h>
+#include "patchcommand.h"
+#include "structrow.h"
+
+/* Cycles of the ATmega644 between two vsyncs (1820 per line, 262 lines) */
+#define CYCLES_PER_FRAME (1820*262)
+
+/*
+ * What a patch costs on the console: the PROGMEM its command array takes as
+ * the editor saves it, and an estimate of the time the kernel's patch player
+ * spends on it every frame while it plays.
+ */
+struct PatchCost {
+  size_t bytes;
+  size_t frames;              /* Frames the patch plays for */
+  size_t commands;            /* Commands run, loops unrolled */
+  size_t peak_commands;       /* Most commands run on one frame */
+  unsigned long peak_cycles;  /* Player cycles on the busiest frame */
+  unsigned long total_cycles;
+
+  double average_cycles() const {
+    return frames ? (double) total_cycles/frames : 0;
+  }
+};
+
+/* Fails, setting `error`, if the patch doesn't compile */
+bool estimate_patch_cost(const wxVector<PatchCommand> &data,
+    PatchCost &cost, wxString &error);
+
+/* PROGMEM of a PatchStruct table */
+size_t struct_flash_bytes(const wxVector<StructRow> &data);
@@ -1,31 +1,13 @@
-#define SAMPLE_RATE 15734
-#define SAMPLES_PER_FRAME ((SAMPLE_RATE)/60)
-#define DEFAULT_VOLUME 0xff
+#pragma once
 
-#define WAVE_HEADER_LEN 44
-
-#define PC_ENV_SPEED 0
-#define PC_NOISE_PARAMS 1
-#define PC_WAVE 2
-#define PC_NOTE_UP 3
-#define PC_NOTE_DOWN 4
-#define PC_NOTE_CUT 5
-#define PC_NOTE_HOLD 6
-#define PC_ENV_VOL 7
-#define PC_PITCH 8
-#define PC_TREMOLO_LEVEL 9
-#define PC_TREMOLO_RATE 10
-#define PC_SLIDE 11
-#define PC_SLIDE_SPEED 12
-#define PC_LOOP_START 13
-#define PC_LOOP_END 14
-#define PATCH_END 255
-
-#define EXTRA_TIME 60
+#include <memory>
+#include "patchprogram.h"
+#include "patchstream.h"
+#include "rendercache.h"
 
 class PatchData : public wxTreeItemData {
   public:
-    wxVector<long> data;
+    wxVector<PatchCommand> data;
 
     PatchData();
     PatchData(const PatchData *p);
@@ -34,14 +16,39 @@ class PatchData : public wxTreeItemData {
     bool play(bool loop=false);
     void retrigger();
     bool generate_wave(wxVector<uint8_t> &out_data);
+    /* Same as generate_wave, going through the render cache */
+    RenderBuffer render();
+    /*
+     * Renders a command stream through the render cache, reading the given
+     * wave tables. Touches no PatchData, so worker threads can use it.
+     */
+    static RenderBuffer render(const wxVector<PatchCommand> &data,
+        const WaveTable *waves, wxString &error);
     wxString last_error;
+    /* Plays patches through a PatchStream instead of a rendered chunk */
+    static bool streaming;
 
   private:
-    wxVector<uint8_t> wave_data;
-    Mix_Chunk *wave;
-    int channel;
+    std::shared_ptr<Voice> voice;
+    bool looping;
+    /*
+     * The compiled program is kept until data changes. Streams hold on to
+     * it, so a new one is made on every compile.
+     */
+    std::shared_ptr<const PatchProgram> program;
+    wxVector<PatchCommand> compiled_data;
+    bool compiled;
+    bool compile_ok;
+    /* Last render, incremental renders resume from its checkpoints */
+    wxVector<PatchCommand> rendered_data;
+    wxVector<RenderCheckpoint> checkpoints;
+    uint64_t rendered_key;
+    uint64_t rendered_waves;
+    uint32_t rendered_wave_mask;
+    int rendered_features;
 
-    void free_chunk();
-    void add_headers(wxVector<uint8_t> &out_data);
-    bool is_noise_patch();
+    bool compile();
+    void render_incremental(wxVector<uint8_t> &out_data, uint64_t key,
+        uint64_t waves);
+    size_t first_changed_row();
 };
@@ -0,0 +1,197 @@
+#include <wx/wxprec.h>
+#ifndef WX_PRECOMP
+  #include <wx/wx.h>
+#endif
+#include "patchgridtable.h"
+
+PatchGridTable::PatchGridTable(const wxString *command_names,
+    const std::map<wxString, long> &command_ids,
+    const std::map<wxString, std::pair<long, long>> &limits) :
+  command_names(command_names), command_ids(command_ids), data(nullptr),
+  attr_row(-1), attr_col(-1) {
+  for (int i = 0; i <= PC_LOOP_END+1; i++) {
+    this->limits[i] = limits.find(command_names[i])->second;
+  }
+
+  valid = new wxGridCellAttr();
+  valid->SetBackgroundColour(wxColour(0, 127, 0));
+  invalid = new wxGridCellAttr();
+  invalid->SetBackgroundColour(wxColor(127, 0, 0));
+
+  /* Command color is always green */
+  command_attr = new wxGridCellAttr();
+  command_attr->SetBackgroundColour(wxColour(0, 127, 0));
+  command_attr->SetEditor(new wxGridCellChoiceEditor(PC_LOOP_END+2,
+        command_names, false));
+}
+
+PatchGridTable::~PatchGridTable() {
+  valid->DecRef();
+  invalid->DecRef();
+  command_attr->DecRef();
+}
+
+void PatchGridTable::set_data(wxVector<PatchCommand> *commands) {
+  /* The commands may have changed under the grid, it knows how many rows
+   * it had */
+  size_t before = GetView()? GetView()->GetNumberRows() : 0;
+  data = commands;
+  size_t after = GetNumberRows();
+
+  if (after > before) {
+    notify(wxGRIDTABLE_NOTIFY_ROWS_INSERTED, before, after - before);
+  }
+  else if (after < before) {
+    notify(wxGRIDTABLE_NOTIFY_ROWS_DELETED, after, before - after);
+  }
+
+  if (GetView()) {
+    /* The grid caches the attribute of the last cell it asked for, and
+     * only that one */
+    GetView()->RefreshAttr(attr_row, attr_col);
+    GetView()->ClearSelection();
+    GetView()->ForceRefresh();
+  }
+}
+
+void PatchGridTable::set_command(int row, const PatchCommand &command) {
+  (*data)[row] = command;
+  /* A new command changes the parameter's limits, so the whole row */
+  if (GetView()) {
+    for (int col = 0; col < 3; col++) {
+      GetView()->RefreshAttr(row, col);
+    }
+    GetView()->GetGridWindow()->RefreshRect(GetView()->BlockToDeviceRect(
+          wxGridCellCoords(row, 0), wxGridCellCoords(row, 2)));
+  }
+}
+
+int PatchGridTable::GetNumberRows() {
+  return data? data->size() : 0;
+}
+
+int PatchGridTable::GetNumberCols() {
+  return 3;
+}
+
+bool PatchGridTable::IsEmptyCell(int row, int col) {
+  (void) row;
+  (void) col;
+  return false;
+}
+
+wxString PatchGridTable::GetValue(int row, int col) {
+  auto &command = (*data)[row];
+  switch (col) {
+    case 0:
+      return wxString::Format(wxT("%d"), command.delay);
+    case 1:
+      return command_names[name_index(command.command)];
+    default:
+      return wxString::Format(wxT("%d"), command.param);
+  }
+}
+
+void PatchGridTable::SetValue(int row, int col, const wxString &value) {
+  PatchCommand command = (*data)[row];
+  long number;
+
+  last_error.Clear();
+  switch (col) {
+    case 0:
+      if (!value.ToLong(&number, 0) || number < 0 || number > UINT8_MAX) {
+        last_error = _("Delays go from 0 to 255");
+        return;
+      }
+      command.delay = number;
+      break;
+
+    case 1: {
+      /* The choice editor only gives command names */
+      auto id = command_ids.find(value);
+      if (id == command_ids.end()) {
+        return;
+      }
+      command.command = id->second;
+      break;
+    }
+
+    default:
+      /* Out of range values are shown in red, but they have to fit in a
+       * PatchCommand to be kept at all */
+      if (!value.ToLong(&number, 0) || number < INT16_MIN
+          || number > INT16_MAX) {
+        last_error = wxString::Format(_("Parameters go from %d to %d"),
+            INT16_MIN, INT16_MAX);
+        return;
+      }
+      command.param = number;
+  }
+
+  set_command(row, command);
+}
+
+bool PatchGridTable::InsertRows(size_t pos, size_t rows) {
+  if (!data || pos > data->size()) {
+    return false;
+  }
+
+  /* What a new row starts as */
+  PatchCommand blank = {0, PC_ENV_SPEED, 0};
+  for (size_t i = 0; i < rows; i++) {
+    data->insert(data->begin() + pos, blank);
+  }
+  notify(wxGRIDTABLE_NOTIFY_ROWS_INSERTED, pos, rows);
+  return true;
+}
+
+bool PatchGridTable::AppendRows(size_t rows) {
+  return InsertRows(GetNumberRows(), rows);
+}
+
+bool PatchGridTable::DeleteRows(size_t pos, size_t rows) {
+  if (!data || pos + rows > data->size()) {
+    return false;
+  }
+
+  data->erase(data->begin() + pos, data->begin() + pos + rows);
+  notify(wxGRIDTABLE_NOTIFY_ROWS_DELETED, pos, rows);
+  return true;
+}
+
+wxString PatchGridTable::GetColLabelValue(int col) {
+  return labels[col];
+}
+
+void PatchGridTable::SetColLabelValue(int col, const wxString &label) {
+  labels[col] = label;
+}
+
+wxGridCellAttr *PatchGridTable::GetAttr(int row, int col,
+    wxGridCellAttr::wxAttrKind kind) {
+  (void) kind;
+  attr_row = row;
+  attr_col = col;
+  wxGridCellAttr *attr = col == 1? command_attr
+    : in_range(row, col)? valid : invalid;
+  attr->IncRef();
+  return attr;
+}
+
+void PatchGridTable::notify(int message, size_t pos, size_t rows) {
+  if (GetView() && rows) {
+    wxGridTableMessage msg(this, message, pos, rows);
+    GetView()->ProcessTableMessage(msg);
+  }
+}
+
+bool PatchGridTable::in_range(int row, int col) const {
+  if (!data || row >= (int) data->size() || col != 2) {
+    return true;
+  }
+
+  /* Param limit depends on the command */
+  auto &command = (*data)[row];
+  auto &limit = limits[name_index(command.command)];
+  return command.param >= limit.first && command.param <= limit.second;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <wx/grid.h>
+#include <wx/vector.h>
+#include <algorithm>
+#include <map>
+#include "patchprogram.h"
+
+/*
+ * The patch grid's cells, read from and written to the commands of the
+ * patch being edited, with no copy of them in between. Cell text and the
+ * red or green of out of range values are worked out as the grid asks.
+ */
+class PatchGridTable : public wxGridTableBase {
+  public:
+    /* Command names with PATCH_END last, their ids and parameter limits */
+    PatchGridTable(const wxString *command_names,
+        const std::map<wxString, long> &command_ids,
+        const std::map<wxString, std::pair<long, long>> &limits);
+    ~PatchGridTable();
+
+    /*
+     * Commands to show, null for none, kept until the next call. Call again
+     * after changing them other than through the table.
+     */
+    void set_data(wxVector<PatchCommand> *commands);
+    const wxVector<PatchCommand> *get_data() const { return data; }
+    const PatchCommand &get_command(int row) const { return (*data)[row]; }
+    void set_command(int row, const PatchCommand &command);
+
+    int GetNumberRows() override;
+    int GetNumberCols() override;
+    bool IsEmptyCell(int row, int col) override;
+    wxString GetValue(int row, int col) override;
+    /* Values that don't fit in a PatchCommand are left out, see last_error */
+    void SetValue(int row, int col, const wxString &value) override;
+    bool InsertRows(size_t pos=0, size_t rows=1) override;
+    bool AppendRows(size_t rows=1) override;
+    bool DeleteRows(size_t pos=0, size_t rows=1) override;
+    wxString GetColLabelValue(int col) override;
+    void SetColLabelValue(int col, const wxString &label) override;
+    wxGridCellAttr *GetAttr(int row, int col,
+        wxGridCellAttr::wxAttrKind kind) override;
+
+    /* Why the last value set was left out, empty if it wasn't */
+    wxString last_error;
+
+  private:
+    const wxString *command_names;
+    const std::map<wxString, long> &command_ids;
+    /* Parameter limits by name, commands past LOOP_END being PATCH_END */
+    std::pair<long, long> limits[PC_LOOP_END+2];
+    wxVector<PatchCommand> *data;
+    wxString labels[3];
+    wxGridCellAttr *valid;
+    wxGridCellAttr *invalid;
+    wxGridCellAttr *command_attr;
+    /* Cell of the last GetAttr(), the one the grid has cached */
+    int attr_row;
+    int attr_col;
+
+    static int name_index(uint8_t command) {
+      return std::min((int) command, PC_LOOP_END+1);
+    }
+    void notify(int message, size_t pos, size_t rows);
+    bool in_range(int row, int col) const;
+};
@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include "patchoptimizer.h"
+#include "patchprogram.h"
+
+#define UNKNOWN LONG_MIN
+
+/*
+ * Values the synth state is known to hold before a row, for the commands
+ * that just set one. Indexed by command, UNKNOWN for the others.
+ */
+struct KnownState {
+  long value[PC_LOOP_END+1];
+
+  KnownState() {
+    forget();
+    value[PC_ENV_SPEED] = 0;
+    value[PC_WAVE] = 0;
+    value[PC_TREMOLO_LEVEL] = 0;
+    value[PC_TREMOLO_RATE] = 24;
+    value[PC_SLIDE_SPEED] = 0x10;
+  }
+
+  void forget() {
+    std::fill(value, value + PC_LOOP_END+1, UNKNOWN);
+  }
+
+  bool is_set(long command, long param) const {
+    return command >= 0 && command <= PC_LOOP_END
+      && value[command] != UNKNOWN && value[command] == param;
+  }
+
+  void apply(long command, long param) {
+    switch (command) {
+      case PC_ENV_SPEED:
+      case PC_WAVE:
+      case PC_TREMOLO_LEVEL:
+      case PC_TREMOLO_RATE:
+      case PC_SLIDE_SPEED:
+        value[command] = param;
+        break;
+
+      /* Rows after these run more than once, with different states */
+      case PC_LOOP_START:
+      case PC_LOOP_END:
+        forget();
+        break;
+    }
+  }
+};
+
+/* Rows a LOOP_END jumps back to by count */
+static wxVector<bool> jump_targets(const wxVector<PatchCommand> &data) {
+  wxVector<bool> targets(data.size(), false);
+
+  for (size_t i = 0; i < data.size(); i++) {
+    if (data[i].command == PC_LOOP_END && data[i].param > 0
+        && data[i].param <= (long) i) {
+      targets[i - data[i].param] = true;
+    }
+  }
+
+  return targets;
+}
+
+/*
+ * Removes a row, adding its delay to the next one if `keep_delay`, and
+ * fixes up the LOOP_END jumps over it. Fails if the delay has nowhere to go
+ * or a jump would become a jump to a LOOP_START.
+ */
+static bool remove_row(wxVector<PatchCommand> &data, size_t row,
+    bool keep_delay) {
+  if (keep_delay && data[row].delay) {
+    if (row + 1 >= data.size() || data[row].delay + data[row+1].delay > 255) {
+      return false;
+    }
+    data[row+1].delay += data[row].delay;
+  }
+
+  for (size_t i = row + 1; i < data.size(); i++) {
+    if (data[i].command == PC_LOOP_END && data[i].param > 0
+        && (long) i - data[i].param <= (long) row) {
+      if (data[i].param == 1) {
+        return false;
+      }
+      data[i].param--;
+    }
+  }
+
+  data.erase(data.begin() + row);
+  return true;
+}
+
+static long note_change(const PatchCommand &c) {
+  return c.command == PC_NOTE_UP? c.param : -c.param;
+}
+
+/* Note changes on the same frame as a note change or a pitch, folded */
+static bool fold_notes(const wxVector<PatchCommand> &data, size_t row,
+    wxVector<PatchCommand> &out) {
+  if (row + 1 >= data.size() || data[row+1].delay != 0
+      || (data[row+1].command != PC_NOTE_UP
+        && data[row+1].command != PC_NOTE_DOWN)) {
+    return false;
+  }
+
+  const PatchCommand &c = data[row];
+  long change = note_change(data[row+1]);
+  out = data;
+  if (c.command == PC_PITCH) {
+    change += c.param;
+    if (change < 0 || change > 126) {
+      return false;
+    }
+    out[row].param = change;
+  }
+  else if (c.command == PC_NOTE_UP || c.command == PC_NOTE_DOWN) {
+    change += note_change(c);
+    if (change < -126 || change > 126) {
+      return false;
+    }
+    out[row].command = change < 0? PC_NOTE_DOWN : PC_NOTE_UP;
+    out[row].param = std::abs(change);
+  }
+  else {
+    return false;
+  }
+
+  return remove_row(out, row+1, false);
+}
+
+/* A command whose effect the next one replaces on the same frame */
+static bool drop_overwritten(const wxVector<PatchCommand> &data, size_t row,
+    wxVector<PatchCommand> &out) {
+  if (row + 1 >= data.size() || data[row+1].delay != 0) {
+    return false;
+  }
+
+  bool overwritten;
+  switch (data[row].command) {
+    case PC_ENV_SPEED:
+    case PC_NOISE_PARAMS:
+    case PC_WAVE:
+    case PC_ENV_VOL:
+    case PC_PITCH:
+    case PC_TREMOLO_LEVEL:
+    case PC_TREMOLO_RATE:
+    case PC_SLIDE_SPEED:
+      overwritten = data[row+1].command == data[row].command;
+      break;
+
+    case PC_NOTE_UP:
+    case PC_NOTE_DOWN:
+      overwritten = data[row+1].command == PC_PITCH;
+      break;
+
+    default:
+      overwritten = false;
+  }
+
+  out = data;
+  return overwritten && remove_row(out, row, true);
+}
+
+/*
+ * A command setting what is already set. Only commands the renderer acts on
+ * are dropped, so the render check can catch a wrong one. NOTE_HOLD renders
+ * as nothing, so it always stays.
+ */
+static bool drop_redundant(const wxVector<PatchCommand> &data, size_t row,
+    const KnownState &state, wxVector<PatchCommand> &out) {
+  if (!state.is_set(data[row].command, data[row].param)) {
+    return false;
+  }
+
+  out = data;
+  return remove_row(out, row, true);
+}
+
+/* Checks a rewrite renders the same samples as the original patch */
+class RenderCheck {
+  public:
+    RenderCheck(const WaveTable *waves) : waves(waves) {}
+
+    bool reference(const wxVector<PatchCommand> &data, wxString &error) {
+      PatchProgram program;
+      if (!program.compile(data)) {
+        error = program.last_error;
+        return false;
+      }
+
+      noise = program.get_features() & FEATURE_NOISE;
+      samples.resize(program.samples());
+      if (!samples.empty()) {
+        program.render(&samples[0], waves);
+      }
+      return true;
+    }
+
+    bool same(const wxVector<PatchCommand> &data) {
+      PatchProgram program;
+      if (!program.compile(data) || program.samples() != samples.size()
+          || (program.get_features() & FEATURE_NOISE) != noise) {
+        return false;
+      }
+
+      scratch.resize(samples.size());
+      if (!samples.empty()) {
+        program.render(&scratch[0], waves);
+      }
+      return std::equal(samples.begin(), samples.end(), scratch.begin());
+    }
+
+  private:
+    const WaveTable *waves;
+    wxVector<uint8_t> samples;
+    wxVector<uint8_t> scratch;
+    int noise;
+};
+
+bool optimize_patch(const wxVector<PatchCommand> &data,
+    wxVector<PatchCommand> &optimized, PatchOptimization &result,
+    wxString &error, const WaveTable *waves) {
+  RenderCheck check(waves);
+  result = {data.size(), data.size(), 0, 0};
+
+  if (!check.reference(data, error)) {
+    return false;
+  }
+
+  optimized = data;
+  wxVector<bool> targets = jump_targets(optimized);
+  /* State before every row up to the current one, to step back to */
+  wxVector<KnownState> states;
+  KnownState state;
+  wxVector<PatchCommand> candidate;
+  size_t row = 0;
+
+  while (row < optimized.size()) {
+    if (targets[row]) {
+      state.forget();
+    }
+    states.resize(row);
+    states.push_back(state);
+
+    bool rewritten = false;
+    for (int rule = 0; rule < 3 && !rewritten; rule++) {
+      bool made = rule == 0? fold_notes(optimized, row, candidate)
+        : rule == 1? drop_overwritten(optimized, row, candidate)
+        : drop_redundant(optimized, row, state, candidate);
+      if (!made) {
+        continue;
+      }
+
+      if (check.same(candidate)) {
+        optimized.swap(candidate);
+        rewritten = true;
+        result.rewrites++;
+      }
+      else {
+        result.rejected++;
+      }
+    }
+
+    if (rewritten) {
+      /* The row before may now fold with what follows it */
+      targets = jump_targets(optimized);
+      if (row) {
+        row--;
+      }
+      state = states[row];
+      continue;
+    }
+
+    state.apply(optimized[row].command, optimized[row].param);
+    row++;
+  }
+
+  result.rows_after = optimized.size();
+  return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <wx/string.h>
+#include <wx/vector.h>
+#include "patchcommand.h"
+#include "waves.h"
+
+struct PatchOptimization {
+  size_t rows_before;
+  size_t rows_after;
+  size_t rewrites;    /* Rewrites kept */
+  size_t rejected;    /* Rewrites dropped because the render changed */
+};
+
+/*
+ * Rewrites a patch into fewer commands: folds note changes that happen on
+ * the same frame, drops commands overwritten on the same frame and commands
+ * setting what is already set, moving their delay to the next command. Only
+ * commands the renderer acts on are touched. Every rewrite is rendered with
+ * the given MAX_WAVES wave tables (waves_ram when null) and only kept if the
+ * samples stay the same.
+ *
+ * Fails, setting `error`, if the patch doesn't compile.
+ */
+bool optimize_patch(const wxVector<PatchCommand> &data,
+    wxVector<PatchCommand> &optimized, PatchOptimization &result,
+    wxString &error, const WaveTable *waves=nullptr);
@@ -0,0 +1,535 @@
+#include <wx/intl.h>
+#include <algorithm>
+#include "patchprogram.h"
+#include "waves.h"
+#include "step_table.h"
+#include "synthkernel.h"
+
+PatchProgram::PatchProgram() : frames(0), features(0), instance(0),
+  wave_mask(1), rows(0), open_end(true) {
+}
+
+bool PatchProgram::compile(const wxVector<PatchCommand> &data) {
+  int8_t note = 80;
+  uint8_t envelope_volume = 0xff;
+  int8_t envelope_step = 0;
+  uint8_t loop_count = 0;
+  uint8_t slide_speed = 0x10;
+
+  events.clear();
+  frames = 0;
+  features = 0;
+  /* Wave 0 is the initial wave and the tremolo table */
+  wave_mask = 1;
+  rows = data.size();
+  open_end = true;
+
+  /* The envelope saturates, so a run of frames can be applied at once */
+  auto advance = [&] (long delay) {
+    long e_vol = envelope_volume + delay*envelope_step;
+    envelope_volume = std::max(0l, std::min(255l, e_vol));
+    frames += delay;
+  };
+
+  for (auto &c : data) {
+    if (c.command == PC_NOISE_PARAMS) {
+      features |= FEATURE_NOISE;
+    }
+    else if (c.command == PC_TREMOLO_LEVEL) {
+      features |= FEATURE_TREMOLO;
+    }
+    else if (c.command == PC_SLIDE) {
+      features |= FEATURE_SLIDE;
+    }
+  }
+  instance = features;
+
+  for (size_t i = 0; i < data.size(); i++) {
+    PatchEvent event = {0, 0, 0, 0, 0};
+    event.row = i;
+    event.command = data[i].command;
+    event.frames = data[i].delay;
+    advance(data[i].delay);
+
+    if (data[i].command == PATCH_END) {
+      events.push_back(event);
+      open_end = false;
+
+      /* The voice plays on until the envelope fades out */
+      event.frames = 0;
+      if (!envelope_volume) {
+        break;
+      }
+      else if (envelope_step < 0) {
+        event.frames = (envelope_volume - envelope_step - 1) / -envelope_step;
+      }
+      else {
+        event.frames = EXTRA_TIME;
+      }
+      events.push_back(event);
+      advance(event.frames);
+      break;
+    }
+    else if (data[i].command == PC_NOTE_CUT) {
+      events.push_back(event);
+      open_end = false;
+      break;
+    }
+
+    int current;
+    int target;
+    switch (data[i].command) {
+      case PC_ENV_SPEED:
+        envelope_step = data[i].param;
+        event.value = envelope_step;
+        if (data[i].param < -128 || data[i].param > 127) {
+          last_error = wxString::Format(
+              _("Command %lu: Invalid envelope speed"), i+1);
+          return false;
+        }
+        break;
+
+      case PC_NOISE_PARAMS:
+        event.value = data[i].param;
+        if (data[i].param < 0 || data[i].param > 255) {
+          last_error = wxString::Format(
+              _("Command %lu: Invalid noise parameter"), i+1);
+          return false;
+        }
+        break;
+
+      case PC_WAVE:
+        event.value = data[i].param;
+        if (data[i].param < 0 || data[i].param >= MAX_WAVES) {
+          last_error = wxString::Format(_("Command %lu: Invalid wave"), i+1);
+          return false;
+        }
+        wave_mask |= 1u << event.value;
+        break;
+
+      case PC_NOTE_UP:
+        note += data[i].param;
+        if (note > 126 || note < 0) {
+          last_error = wxString::Format(
+              _("Command %lu: Invalid note reached"), i+1);
+          return false;
+        }
+        event.value = step_table[(int) note];
+        break;
+
+      case PC_NOTE_DOWN:
+        note -= data[i].param;
+        if (note > 126 || note < 0) {
+          last_error = wxString::Format(
+              _("Command %lu: Invalid note reached"), i+1);
+          return false;
+        }
+        event.value = step_table[(int) note];
+        break;
+
+      /*
+       * Deliberately a no-op. What it holds on the console is up to the
+       * music player, and patches render here without one. The event is
+       * still kept, so checkpoints find its row.
+       */
+      case PC_NOTE_HOLD:
+        break;
+
+      case PC_ENV_VOL:
+        envelope_volume = data[i].param;
+        event.value = envelope_volume;
+        if (data[i].param < 0 || data[i].param > 255) {
+          last_error = wxString::Format(
+              _("Command %lu: Invalid envelope volume"), i+1);
+          return false;
+        }
+        break;
+
+      case PC_PITCH:
+        note = data[i].param;
+        if (note > 126 || note < 0) {
+          last_error = wxString::Format(
+              _("Command %lu: Invalid note"), i+1);
+          return false;
+        }
+        event.value = step_table[(int) note];
+        break;
+
+      case PC_TREMOLO_LEVEL:
+        event.value = data[i].param;
+        if (data[i].param < 0 || data[i].param > 255) {
+          last_error = wxString::Format(
+              _("Command %lu: Invalid tremolo level"), i+1);
+          return false;
+        }
+        break;
+
+      case PC_TREMOLO_RATE:
+        event.value = data[i].param;
+        if (data[i].param < 0 || data[i].param > 255) {
+          last_error = wxString::Format(
+              _("Command %lu: Invalid tremolo rate"), i+1);
+          return false;
+        }
+        break;
+
+      case PC_SLIDE:
+        current = step_table[(int) note];
+        event.note = note + data[i].param;
+        if (event.note > 126 || event.note < 0) {
+          last_error = wxString::Format(
+              _("Command %lu: Invalid slide note"), i+1);
+          return false;
+        }
+        else if (!slide_speed) {
+          last_error = wxString::Format(
+              _("Command %lu: Slide with a zero slide speed"), i+1);
+          return false;
+        }
+        target = step_table[(int) event.note];
+        event.value = (int16_t) std::max(1, (target-current)/slide_speed);
+        break;
+
+      case PC_SLIDE_SPEED:
+        slide_speed = data[i].param;
+        if (data[i].param < 0 || data[i].param > 255) {
+          last_error = wxString::Format(
+              _("Command %lu: Invalid slide speed"), i+1);
+          return false;
+        }
+        break;
+
+      case PC_LOOP_END:
+        events.push_back(event);
+        if (data[i].param < 0 || data[i].param > 255) {
+          last_error = wxString::Format(
+              _("Command %lu: Invalid loop end jump"), i+1);
+          return false;
+        }
+        else if (data[i].param > (long) i) {
+          last_error = wxString::Format(
+              _("Command %lu: Loop end jump to negative command"), i+1);
+          return false;
+        }
+        if (loop_count) {
+          size_t old_i = i;
+          loop_count--;
+          if (data[i].param > 0) {
+            for (long to_return = data[i].param+1; to_return--; i--) {
+              if (data[i].command == PC_LOOP_START) {
+                last_error = wxString::Format(_("Command %lu: Loop end jump "
+                      "to before a loop start causes infinite loop"),
+                    old_i+1);
+                return false;
+              }
+            }
+          }
+          else {
+            do {
+              i--;
+            } while(i >= 1 && data[i].command != PC_LOOP_START);
+            if (data[i].command != PC_LOOP_START) {
+              last_error = wxString::Format(
+                  _("Command %lu: No previous loop start"), old_i+1);
+              return false;
+            }
+          }
+        }
+        continue;
+
+      case PC_LOOP_START:
+        loop_count = data[i].param;
+        if (data[i].param < 0 || data[i].param > 255) {
+          last_error = wxString::Format(
+              _("Command %lu: Invalid loop count"), i+1);
+          return false;
+        }
+        break;
+
+      default:
+        break;
+    }
+
+    events.push_back(event);
+  }
+
+  return true;
+}
+
+bool PatchProgram::use_instance(int flags) {
+  if (flags < 0 || flags > 7 || (features & ~flags)
+      || (flags & FEATURE_NOISE) != (features & FEATURE_NOISE)) {
+    return false;
+  }
+  instance = flags;
+  return true;
+}
+
+template <bool NOISE, bool TREMOLO, bool SLIDE>
+static uint8_t *render_frames(SynthState &s, uint8_t *out, long frames,
+    const WaveTable *waves) {
+  for (; frames; frames--) {
+    int16_t e_vol = s.envelope_volume + s.envelope_step;
+    e_vol = std::max((int16_t) 0, std::min((int16_t) 0xff, e_vol));
+    s.envelope_volume = e_vol;
+
+    if (SLIDE && s.sliding) {
+      s.track_step += s.slide_step;
+      uint16_t t_step = step_table[(int) s.slide_note];
+
+      if ((s.slide_step > 0 && s.track_step >= t_step)
+          || (s.slide_step < 0 && s.track_step <= t_step)) {
+        s.track_step = t_step;
+        s.sliding = false;
+      }
+    }
+
+    uint16_t vol = s.note_volume;
+    if (s.note_volume && s.envelope_volume) {
+      vol = ((vol*s.envelope_volume)+0x100) >> 8;
+
+      /* Assumes the master volume is 0xff, no calculation needed */
+
+      if (TREMOLO && s.tremolo_level > 0) {
+        uint8_t t =            waves[0][s.tremolo_pos];
+        t -= 128;
+        uint16_t t_vol = (s.tremolo_level*t)+0x100;
+        t_vol >>= 8;
+        vol = ((vol*(0xff-t_vol)) + 0x100) >> 8;
+      }
+    }
+    else {
+      vol = 0;
+    }
+
+    s.tremolo_pos += s.tremolo_rate;
+
+    if (NOISE) {
+      render_noise_block(out, SAMPLES_PER_FRAME, s.noise_barrel,
+          s.noise_divider, s.noise_params, vol);
+    }
+    else {
+      s.next_sample = render_wave_block(out, SAMPLES_PER_FRAME,
+          &waves[s.wave][0], s.next_sample, s.track_step, vol);
+    }
+    out += SAMPLES_PER_FRAME;
+  }
+
+  return out;
+}
+
+static void apply_event(SynthState &s, const PatchEvent &event) {
+  switch (event.command) {
+    case PC_ENV_SPEED:
+      s.envelope_step = event.value;
+      break;
+
+    case PC_NOISE_PARAMS:
+      s.noise_barrel = 0x0101;
+      s.noise_params = event.value;
+      break;
+
+    case PC_WAVE:
+      s.wave = event.value;
+      break;
+
+    case PC_NOTE_UP:
+    case PC_NOTE_DOWN:
+      s.track_step = event.value;
+      break;
+
+    case PC_ENV_VOL:
+      s.envelope_volume = event.value;
+      break;
+
+    case PC_PITCH:
+      s.track_step = event.value;
+      s.sliding = false;
+      break;
+
+    case PC_TREMOLO_LEVEL:
+      s.tremolo_level = event.value;
+      break;
+
+    case PC_TREMOLO_RATE:
+      s.tremolo_rate = event.value;
+      break;
+
+    case PC_SLIDE:
+      s.slide_note = event.note;
+      s.slide_step = event.value;
+      s.track_step += s.slide_step;
+      break;
+
+    default:
+      break;
+  }
+}
+
+/*
+ * Renderer specialized on the features a patch can use, so the per frame
+ * code carries no branches for the ones it never touches. NOISE isn't
+ * optional, it renders noise instead of waves, so the generic path is
+ * <NOISE, true, true>.
+ */
+template <bool NOISE, bool TREMOLO, bool SLIDE>
+void PatchProgram::render_events(uint8_t *out, const RenderCheckpoint &from,
+    wxVector<RenderCheckpoint> *checkpoints, const WaveTable *waves) const {
+  SynthState s = from.state;
+  size_t offset = from.offset;
+
+  out += offset;
+  for (size_t e = from.event; e < events.size(); e++) {
+    auto &event = events[e];
+    if (checkpoints && (*checkpoints)[event.row].event == NO_CHECKPOINT) {
+      (*checkpoints)[event.row] = {e, offset, s};
+    }
+    out = render_frames<NOISE, TREMOLO, SLIDE>(s, out, event.frames, waves);
+    offset += event.frames*SAMPLES_PER_FRAME;
+    apply_event(s, event);
+  }
+
+  if (checkpoints && open_end) {
+    (*checkpoints)[rows] = {events.size(), offset, s};
+  }
+}
+
+template <bool NOISE, bool TREMOLO, bool SLIDE>
+size_t PatchProgram::stream_events(uint8_t *out, size_t frames,
+    StreamPosition &pos, const WaveTable *waves) const {
+  size_t done = 0;
+
+  while (done < frames && pos.event < events.size()) {
+    auto &event = events[pos.event];
+    size_t n = std::min(frames - done, event.frames - pos.frame);
+    out = render_frames<NOISE, TREMOLO, SLIDE>(pos.state, out, n, waves);
+    done += n;
+    pos.frame += n;
+
+    if (pos.frame == event.frames) {
+      apply_event(pos.state, event);
+      pos.event++;
+      pos.frame = 0;
+    }
+  }
+
+  return done;
+}
+
+size_t PatchProgram::stream(uint8_t *out, size_t frames,
+    StreamPosition &pos, const WaveTable *waves) const {
+  typedef size_t (PatchProgram::*Streamer)(uint8_t *, size_t,
+      StreamPosition &, const WaveTable *) const;
+  /* Indexed by the FEATURE_* flags */
+  static const Streamer streamers[8] = {
+    &PatchProgram::stream_events<false, false, false>,
+    &PatchProgram::stream_events<false, false, true>,
+    &PatchProgram::stream_events<false, true, false>,
+    &PatchProgram::stream_events<false, true, true>,
+    &PatchProgram::stream_events<true, false, false>,
+    &PatchProgram::stream_events<true, false, true>,
+    &PatchProgram::stream_events<true, true, false>,
+    &PatchProgram::stream_events<true, true, true>,
+  };
+
+  return (this->*streamers[instance])(out, frames, pos,
+      waves? waves : waves_ram);
+}
+
+RenderCheckpoint PatchProgram::start() const {
+  return {0, 0, SynthState()};
+}
+
+void PatchProgram::render(uint8_t *out, const WaveTable *waves) const {
+  render(out, start(), nullptr, waves);
+}
+
+void PatchProgram::render(uint8_t *out, const RenderCheckpoint &from,
+    wxVector<RenderCheckpoint> *checkpoints, const WaveTable *waves) const {
+  typedef void (PatchProgram::*Renderer)(uint8_t *, const RenderCheckpoint &,
+      wxVector<RenderCheckpoint> *, const WaveTable *) const;
+  /* Indexed by the FEATURE_* flags */
+  static const Renderer renderers[8] = {
+    &PatchProgram::render_events<false, false, false>,
+    &PatchProgram::render_events<false, false, true>,
+    &PatchProgram::render_events<false, true, false>,
+    &PatchProgram::render_events<false, true, true>,
+    &PatchProgram::render_events<true, false, false>,
+    &PatchProgram::render_events<true, false, true>,
+    &PatchProgram::render_events<true, true, false>,
+    &PatchProgram::render_events<true, true, true>,
+  };
+
+  (this->*renderers[instance])(out, from, checkpoints,
+      waves? waves : waves_ram);
+}
+
+void add_wave_headers(wxVector<uint8_t> &out_data) {
+  size_t data_size = out_data.size() - WAVE_HEADER_LEN;
+  const uint32_t subchunk2_size = data_size & 1? data_size+1 : data_size;
+  const uint32_t chunk_size = subchunk2_size + 36;
+  const uint32_t sample_rate = SAMPLE_RATE;
+  int pos = 0;
+
+  /* ChunkID */
+  out_data[pos++] = 'R';
+  out_data[pos++] = 'I';
+  out_data[pos++] = 'F';
+  out_data[pos++] = 'F';
+  /* ChunkSize */
+  out_data[pos++] = chunk_size & 0xff;
+  out_data[pos++] = (chunk_size>>8) & 0xff;
+  out_data[pos++] = (chunk_size>>16) & 0xff;
+  out_data[pos++] = (chunk_size>>24) & 0xff;
+  /* Format */
+  out_data[pos++] = 'W';
+  out_data[pos++] = 'A';
+  out_data[pos++] = 'V';
+  out_data[pos++] = 'E';
+  /* Subchunk1ID */
+  out_data[pos++] = 'f';
+  out_data[pos++] = 'm';
+  out_data[pos++] = 't';
+  out_data[pos++] = ' ';
+  /* Subchunk1Size*/
+  out_data[pos++] = 16;
+  out_data[pos++] = 0;
+  out_data[pos++] = 0;
+  out_data[pos++] = 0;
+  /* AudioFormat */
+  out_data[pos++] = 1;
+  out_data[pos++] = 0;
+  /* NumChannels */
+  out_data[pos++] = 1;
+  out_data[pos++] = 0;
+  /* SampleRate */
+  out_data[pos++] = sample_rate & 0xff;
+  out_data[pos++] = (sample_rate>>8) & 0xff;
+  out_data[pos++] = (sample_rate>>16) & 0xff;
+  out_data[pos++] = (sample_rate>>24) & 0xff;
+  /* ByteRate */
+  out_data[pos++] = sample_rate & 0xff;
+  out_data[pos++] = (sample_rate>>8) & 0xff;
+  out_data[pos++] = (sample_rate>>16) & 0xff;
+  out_data[pos++] = (sample_rate>>24) & 0xff;
+  /* BlockAlign */
+  out_data[pos++] = 1;
+  out_data[pos++] = 0;
+  /* BitsPerSample */
+  out_data[pos++] = 8;
+  out_data[pos++] = 0;
+  /* Subchunk2ID */
+  out_data[pos++] = 'd';
+  out_data[pos++] = 'a';
+  out_data[pos++] = 't';
+  out_data[pos++] = 'a';
+  /* Subchunk2Size */
+  out_data[pos++] = subchunk2_size & 0xff;
+  out_data[pos++] = (subchunk2_size>>8) & 0xff;
+  out_data[pos++] = (subchunk2_size>>16) & 0xff;
+  out_data[pos++] = (subchunk2_size>>24) & 0xff;
+
+  /* Padding */
+  if (out_data.size() & 1)
+    out_data.push_back(0);
+}
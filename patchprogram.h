@@ -0,0 +1,154 @@
+#pragma once
+
+#include <wx/string.h>
+#include <wx/vector.h>
+#include <cstdint>
+#include "patchcommand.h"
+#include "waves.h"
+
+#define SAMPLE_RATE 15734
+#define SAMPLES_PER_FRAME ((SAMPLE_RATE)/60)
+#define DEFAULT_VOLUME 0xff
+
+#define PC_ENV_SPEED 0
+#define PC_NOISE_PARAMS 1
+#define PC_WAVE 2
+#define PC_NOTE_UP 3
+#define PC_NOTE_DOWN 4
+#define PC_NOTE_CUT 5
+#define PC_NOTE_HOLD 6
+#define PC_ENV_VOL 7
+#define PC_PITCH 8
+#define PC_TREMOLO_LEVEL 9
+#define PC_TREMOLO_RATE 10
+#define PC_SLIDE 11
+#define PC_SLIDE_SPEED 12
+#define PC_LOOP_START 13
+#define PC_LOOP_END 14
+#define PATCH_END 255
+
+#define EXTRA_TIME 60
+
+#define WAVE_HEADER_LEN 44
+
+/* Flags of PatchProgram::get_features() */
+#define FEATURE_SLIDE 1
+#define FEATURE_TREMOLO 2
+#define FEATURE_NOISE 4
+
+/*
+ * One executed command of a compiled patch. Loops are unrolled and note
+ * arithmetic is resolved at compile time, so `value` is ready to be stored
+ * in the synth state (a step for notes, the slide step for slides).
+ */
+struct PatchEvent {
+  uint16_t frames;    /* Frames rendered before the command takes effect */
+  uint8_t command;
+  int8_t note;        /* Slide target note */
+  uint32_t row;       /* Command of the source stream */
+  int32_t value;
+};
+
+/* Voice state of the renderer */
+struct SynthState {
+  uint16_t next_sample = 0;
+  uint8_t note_volume = DEFAULT_VOLUME;
+  uint8_t envelope_volume = 0xff;
+  int8_t envelope_step = 0;
+  uint8_t wave = 0;
+  uint8_t tremolo_level = 0;
+  uint8_t tremolo_rate = 24;
+  uint8_t tremolo_pos = 0;
+  int16_t slide_step = 0;
+  int8_t slide_note = 0;
+  bool sliding = false;
+  uint16_t track_step = 0;
+  uint16_t noise_barrel = 0x0101;
+  uint8_t noise_params = 1;
+  int8_t noise_divider = 0;
+};
+
+/* Synth state the first time a row of the source stream is reached */
+struct RenderCheckpoint {
+  size_t event;       /* NO_CHECKPOINT if the row was never reached */
+  size_t offset;      /* Samples rendered before it */
+  SynthState state;
+};
+
+#define NO_CHECKPOINT ((size_t) -1)
+
+/* Where a streamed render stopped */
+struct StreamPosition {
+  size_t event = 0;
+  size_t frame = 0;   /* Frames of the event already rendered */
+  SynthState state;
+};
+
+/*
+ * Validated form of a patch command stream. compile() does all the checks
+ * generate_wave used to do while rendering, render() can't fail.
+ */
+class PatchProgram {
+  public:
+    PatchProgram();
+    bool compile(const wxVector<PatchCommand> &data);
+    /*
+     * Writes samples() bytes to out. The render* and stream calls read the
+     * given MAX_WAVES wave tables, waves_ram when it's null.
+     */
+    void render(uint8_t *out, const WaveTable *waves=nullptr) const;
+    /*
+     * Resumes rendering at `from`, writing from out+from.offset on. If
+     * given, `checkpoints` holds get_rows()+1 entries (the last one is for
+     * running past the last row) and the ones still set to NO_CHECKPOINT
+     * are filled in as their rows are reached.
+     */
+    void render(uint8_t *out, const RenderCheckpoint &from,
+        wxVector<RenderCheckpoint> *checkpoints,
+        const WaveTable *waves=nullptr) const;
+    RenderCheckpoint start() const;
+    /* Renders up to `frames` frames from pos on, returns how many it did */
+    size_t stream(uint8_t *out, size_t frames, StreamPosition &pos,
+        const WaveTable *waves=nullptr) const;
+    size_t samples() const { return frames*SAMPLES_PER_FRAME; }
+    /* Bit mask of the waves_ram tables the program reads */
+    uint32_t waves() const { return wave_mask; }
+    int get_features() const { return features; }
+    /*
+     * Renders and streams with the instance for the given FEATURE_* flags
+     * from now until the next compile(), for checking the instances against
+     * each other. Fails if the flags leave out any of get_features() or
+     * differ from them in FEATURE_NOISE.
+     */
+    bool use_instance(int flags);
+    size_t get_rows() const { return rows; }
+    /* Commands in the order they run, loops unrolled */
+    const wxVector<PatchEvent> &get_events() const { return events; }
+
+    wxString last_error;
+
+  private:
+    wxVector<PatchEvent> events;
+    size_t frames;
+    int features;
+    /* FEATURE_* flags of the render_events and stream_events used */
+    int instance;
+    uint32_t wave_mask;
+    size_t rows;
+    /* Set when rendering runs past the last row */
+    bool open_end;
+
+    template <bool NOISE, bool TREMOLO, bool SLIDE>
+    void render_events(uint8_t *out, const RenderCheckpoint &from,
+        wxVector<RenderCheckpoint> *checkpoints,
+        const WaveTable *waves) const;
+    template <bool NOISE, bool TREMOLO, bool SLIDE>
+    size_t stream_events(uint8_t *out, size_t frames, StreamPosition &pos,
+        const WaveTable *waves) const;
+};
+
+/*
+ * Fills in the first WAVE_HEADER_LEN bytes of out_data with a RIFF header
+ * for the samples that follow, padding them to an even length.
+ */
+void add_wave_headers(wxVector<uint8_t> &out_data);
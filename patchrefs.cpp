@@ -0,0 +1,79 @@
+#include "patchrefs.h"
+
+void PatchReferences::add(const wxTreeItemId &item,
+    const wxVector<StructRow> &rows) {
+  for (auto &row : rows) {
+    auto &use = uses[patch_symbols.resolve(row.patch)][item.GetID()];
+    use.item = item;
+    use.rows++;
+  }
+}
+
+void PatchReferences::remove(const wxTreeItemId &item,
+    const wxVector<StructRow> &rows) {
+  for (auto &row : rows) {
+    auto patch = uses.find(patch_symbols.resolve(row.patch));
+    if (patch == uses.end()) {
+      continue;
+    }
+
+    auto use = patch->second.find(item.GetID());
+    if (use != patch->second.end() && !--use->second.rows) {
+      patch->second.erase(use);
+      if (patch->second.empty()) {
+        uses.erase(patch);
+      }
+    }
+  }
+}
+
+void PatchReferences::merge(Symbol from, Symbol into) {
+  auto merged = uses.find(from);
+  if (from == into || merged == uses.end()) {
+    return;
+  }
+
+  auto moved = std::move(merged->second);
+  uses.erase(merged);
+  auto &target = uses[into];
+  for (auto &use : moved) {
+    auto &to = target[use.first];
+    to.item = use.second.item;
+    to.rows += use.second.rows;
+  }
+}
+
+void PatchReferences::clear() {
+  uses.clear();
+}
+
+size_t PatchReferences::rows(Symbol patch) const {
+  size_t count = 0;
+  if (patch == NO_SYMBOL) {
+    return count;
+  }
+
+  auto found = uses.find(patch_symbols.resolve(patch));
+  if (found != uses.end()) {
+    for (auto &use : found->second) {
+      count += use.second.rows;
+    }
+  }
+  return count;
+}
+
+wxVector<std::pair<wxTreeItemId, size_t>> PatchReferences::structs(
+    Symbol patch) const {
+  wxVector<std::pair<wxTreeItemId, size_t>> found_structs;
+  if (patch == NO_SYMBOL) {
+    return found_structs;
+  }
+
+  auto found = uses.find(patch_symbols.resolve(patch));
+  if (found != uses.end()) {
+    for (auto &use : found->second) {
+      found_structs.push_back({use.second.item, use.second.rows});
+    }
+  }
+  return found_structs;
+}
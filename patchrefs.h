@@ -0,0 +1,34 @@
+#pragma once
+
+#include <wx/treebase.h>
+#include <wx/vector.h>
+#include <map>
+#include <unordered_map>
+#include "structrow.h"
+
+/*
+ * Which structs have rows referring to each patch, so finding the users of
+ * a patch takes time in the number of them rather than in all struct rows.
+ * Patches are keyed by resolved symbol, so when a rename merges two symbols
+ * merge() has to be told.
+ */
+class PatchReferences {
+  public:
+    void add(const wxTreeItemId &item, const wxVector<StructRow> &rows);
+    void remove(const wxTreeItemId &item, const wxVector<StructRow> &rows);
+    /* `from` was merged into `into`, both as they resolved before */
+    void merge(Symbol from, Symbol into);
+    void clear();
+
+    /* Struct rows referring to the patch, none for NO_SYMBOL */
+    size_t rows(Symbol patch) const;
+    /* The structs those rows are in, with the row count of each */
+    wxVector<std::pair<wxTreeItemId, size_t>> structs(Symbol patch) const;
+
+  private:
+    struct Uses {
+      wxTreeItemId item;
+      size_t rows = 0;
+    };
+    std::unordered_map<Symbol, std::map<void *, Uses>> uses;
+};
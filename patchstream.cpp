@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <cstring>
+#include "patchstream.h"
+
+PatchStream::PatchStream(std::shared_ptr<const PatchProgram> program,
+    bool loop) : program(program), waves(snapshot_waves()), loop(loop),
+  done(false),
+  frame_pos(SAMPLES_PER_FRAME) {
+}
+
+size_t PatchStream::read(uint8_t *out, size_t count) {
+  size_t written = 0;
+
+  while (written < count && !done) {
+    if (frame_pos == SAMPLES_PER_FRAME) {
+      if (program->stream(frame, 1, pos, waves->data()) == 0) {
+        /* An empty patch would loop forever without making a sound */
+        if (loop && program->samples()) {
+          pos = StreamPosition();
+        }
+        else {
+          done = true;
+        }
+        continue;
+      }
+      frame_pos = 0;
+    }
+
+    size_t n = std::min(count - written, SAMPLES_PER_FRAME - frame_pos);
+    memcpy(out + written, frame + frame_pos, n);
+    frame_pos += n;
+    written += n;
+  }
+
+  return written;
+}
+
+void PatchStream::restart() {
+  pos = StreamPosition();
+  frame_pos = SAMPLES_PER_FRAME;
+  done = false;
+}
+
+BufferVoice::BufferVoice(const RenderBuffer &buffer, size_t header,
+    bool loop) : buffer(buffer), header(header), loop(loop), pos(header) {
+}
+
+size_t BufferVoice::read(uint8_t *out, size_t count) {
+  size_t written = 0;
+
+  while (written < count) {
+    if (pos == buffer->size()) {
+      if (!loop || buffer->size() == header) {
+        break;
+      }
+      pos = header;
+    }
+
+    size_t n = std::min(count - written, buffer->size() - pos);
+    memcpy(out + written, &(*buffer)[pos], n);
+    pos += n;
+    written += n;
+  }
+
+  return written;
+}
+
+void BufferVoice::restart() {
+  pos = header;
+}
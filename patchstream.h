@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include "patchprogram.h"
+#include "rendercache.h"
+#include "uzemixer.h"
+
+/*
+ * Pull based generator over a compiled patch. Samples are rendered a frame
+ * at a time as they are read, so only one frame is ever held in memory. The
+ * program is shared so it stays valid while the patch gets recompiled, and
+ * the waves are a copy taken when the stream is made, as the audio thread
+ * reads them while the wave editor may be writing waves_ram.
+ */
+class PatchStream : public Voice {
+  public:
+    PatchStream(std::shared_ptr<const PatchProgram> program, bool loop);
+
+    size_t read(uint8_t *out, size_t count) override;
+    void restart() override;
+
+  private:
+    std::shared_ptr<const PatchProgram> program;
+    std::shared_ptr<const WaveBank> waves;
+    bool loop;
+    bool done;
+    StreamPosition pos;
+    uint8_t frame[SAMPLES_PER_FRAME];
+    size_t frame_pos;
+};
+
+/* Plays the samples of an already rendered patch */
+class BufferVoice : public Voice {
+  public:
+    /* Samples start after `header` bytes of the buffer */
+    BufferVoice(const RenderBuffer &buffer, size_t header, bool loop);
+
+    size_t read(uint8_t *out, size_t count) override;
+    void restart() override;
+
+  private:
+    RenderBuffer buffer;
+    size_t header;
+    bool loop;
+    size_t pos;
+};
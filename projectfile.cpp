@@ -0,0 +1,357 @@
+#include <wx/ffile.h>
+#include <wx/intl.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include "filereader.h"
+#include "mappedfile.h"
+#include "projectfile.h"
+#include "serializer.h"
+
+/*
+ * Layout, all integers 32 bits little endian:
+ *
+ *   header   magic, version, patch, command, struct, row and wave counts,
+ *            string table size
+ *   patches  name, number of commands
+ *   commands delay, command, parameter
+ *   structs  name, number of rows
+ *   rows     type (one byte), PCM data name, patch name, loop start and end
+ *   waves    WAVE_SIZE bytes each, as held in memory
+ *   strings  NUL terminated UTF-8, names point into it
+ *
+ * Loop points are numbers, or ~offset of their text in the string table
+ * when they aren't plain numbers, as StructRow holds them. Commands and
+ * rows of a patch or struct follow the ones of the previous one, so tables
+ * need no offsets and every section has a fixed size.
+ */
+#define PROJECT_MAGIC "UZEPROJ"
+#define PROJECT_MAGIC_LEN 8
+#define PROJECT_VERSION 2
+#define PROJECT_HEADER_LEN (PROJECT_MAGIC_LEN + 7*4)
+#define PATCH_ENTRY_LEN 8
+#define COMMAND_ENTRY_LEN 12
+#define STRUCT_ENTRY_LEN 8
+#define ROW_ENTRY_LEN 17
+
+static void put_u32(Serializer &out, uint32_t value) {
+  uint8_t bytes[4] = {
+    (uint8_t) value, (uint8_t) (value >> 8), (uint8_t) (value >> 16),
+    (uint8_t) (value >> 24),
+  };
+  out.bytes(bytes, 4);
+}
+
+static uint32_t get_u32(const char *p) {
+  const uint8_t *b = (const uint8_t *) p;
+  return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t) b[3] << 24;
+}
+
+bool ProjectFile::is_project(const wxString &fn) {
+  wxFFile file(fn, "rb");
+  char magic[PROJECT_MAGIC_LEN];
+
+  return file.IsOpened() && file.Read(magic, PROJECT_MAGIC_LEN)
+    == PROJECT_MAGIC_LEN && memcmp(magic, PROJECT_MAGIC, PROJECT_MAGIC_LEN) == 0;
+}
+
+/* Interns strings so names repeated across the project are stored once */
+class StringTable {
+  public:
+    uint32_t add(const wxString &str) {
+      std::string utf8 = (const char *) str.utf8_str();
+      auto found = offsets.find(utf8);
+      if (found != offsets.end()) {
+        return found->second;
+      }
+
+      uint32_t offset = strings.size();
+      strings.append(utf8.c_str(), utf8.size() + 1);
+      offsets.emplace(utf8, offset);
+      return offset;
+    }
+
+    std::string strings;
+
+  private:
+    std::unordered_map<std::string, uint32_t> offsets;
+};
+
+bool ProjectFile::write(const wxString &fn, const Project &project) {
+  StringTable table;
+  Serializer out;
+  size_t commands = 0, rows = 0;
+
+  for (auto &patch : project.patches) {
+    commands += patch.data.size();
+  }
+  for (auto &s : project.structs) {
+    rows += s.data.size();
+  }
+  size_t waves = std::min(project.waves.size(), (size_t) MAX_WAVES);
+
+  /* The string table goes last, but the header needs its size */
+  wxVector<uint32_t> patch_names, struct_names, row_strings;
+  for (auto &patch : project.patches) {
+    patch_names.push_back(table.add(patch.name));
+  }
+  for (auto &s : project.structs) {
+    struct_names.push_back(table.add(s.name));
+    for (auto &row : s.data) {
+      row_strings.push_back(table.add(row.pcm_name()));
+      row_strings.push_back(table.add(row.patch_name()));
+      for (int32_t loop : {row.loop_start, row.loop_end}) {
+        row_strings.push_back(loop >= 0? (uint32_t) loop
+            : ~table.add(loop_point_text(loop)));
+      }
+    }
+  }
+
+  out.reserve(PROJECT_HEADER_LEN + project.patches.size()*PATCH_ENTRY_LEN
+      + commands*COMMAND_ENTRY_LEN + project.structs.size()*STRUCT_ENTRY_LEN
+      + rows*ROW_ENTRY_LEN + waves*WAVE_SIZE + table.strings.size());
+
+  out.bytes(PROJECT_MAGIC, PROJECT_MAGIC_LEN);
+  put_u32(out, PROJECT_VERSION);
+  put_u32(out, project.patches.size());
+  put_u32(out, commands);
+  put_u32(out, project.structs.size());
+  put_u32(out, rows);
+  put_u32(out, waves);
+  put_u32(out, table.strings.size());
+
+  for (size_t i = 0; i < project.patches.size(); i++) {
+    put_u32(out, patch_names[i]);
+    put_u32(out, project.patches[i].data.size());
+  }
+  for (auto &patch : project.patches) {
+    for (auto &c : patch.data) {
+      put_u32(out, c.delay);
+      put_u32(out, c.command);
+      put_u32(out, (uint32_t) c.param);
+    }
+  }
+
+  for (size_t i = 0; i < project.structs.size(); i++) {
+    put_u32(out, struct_names[i]);
+    put_u32(out, project.structs[i].data.size());
+  }
+  size_t row_string = 0;
+  for (auto &s : project.structs) {
+    for (auto &row : s.data) {
+      uint8_t type = row.type;
+      out.bytes(&type, 1);
+      for (int i = 0; i < 4; i++) {
+        put_u32(out, row_strings[row_string++]);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < waves; i++) {
+    out.bytes(project.waves[i].data(), WAVE_SIZE);
+  }
+  out.bytes(table.strings.data(), table.strings.size());
+
+  return out.write(fn);
+}
+
+/* Reads a string of the table, which is known to end with a NUL */
+static bool get_string(const char *strings, uint32_t size, uint32_t offset,
+    wxString &str) {
+  if (offset >= size) {
+    return false;
+  }
+  str = wxString::FromUTF8(strings + offset);
+  return true;
+}
+
+bool ProjectFile::read(const wxString &fn, Project &project,
+    wxString &error) {
+  MappedFile file;
+
+  if (!file.open(fn)) {
+    error = wxString::Format(_("Failed to open %s"), fn);
+    return false;
+  }
+
+  const char *p = file.begin();
+  size_t size = file.size();
+  if (size < PROJECT_HEADER_LEN
+      || memcmp(p, PROJECT_MAGIC, PROJECT_MAGIC_LEN) != 0) {
+    error = wxString::Format(_("%s is not a project file"), fn);
+    return false;
+  }
+
+  const char *header = p + PROJECT_MAGIC_LEN;
+  uint32_t version = get_u32(header);
+  if (version != PROJECT_VERSION) {
+    error = wxString::Format(_("%s has unsupported project version %u"), fn,
+        version);
+    return false;
+  }
+
+  uint64_t patches = get_u32(header + 4);
+  uint64_t commands = get_u32(header + 8);
+  uint64_t structs = get_u32(header + 12);
+  uint64_t rows = get_u32(header + 16);
+  uint64_t waves = get_u32(header + 20);
+  uint64_t strings_size = get_u32(header + 24);
+
+  uint64_t expected = PROJECT_HEADER_LEN + patches*PATCH_ENTRY_LEN
+    + commands*COMMAND_ENTRY_LEN + structs*STRUCT_ENTRY_LEN
+    + rows*ROW_ENTRY_LEN + waves*WAVE_SIZE + strings_size;
+  if (expected != size || waves > MAX_WAVES
+      || (strings_size && p[size-1] != '\0')) {
+    error = wxString::Format(_("%s is damaged"), fn);
+    return false;
+  }
+
+  const char *patch_table = p + PROJECT_HEADER_LEN;
+  const char *command_table = patch_table + patches*PATCH_ENTRY_LEN;
+  const char *struct_table = command_table + commands*COMMAND_ENTRY_LEN;
+  const char *row_table = struct_table + structs*STRUCT_ENTRY_LEN;
+  const char *wave_table = row_table + rows*ROW_ENTRY_LEN;
+  const char *strings = wave_table + waves*WAVE_SIZE;
+
+  project.patches.clear();
+  project.structs.clear();
+  project.waves.clear();
+
+  project.patches.resize(patches);
+  uint64_t command = 0;
+  for (uint64_t i = 0; i < patches; i++) {
+    const char *entry = patch_table + i*PATCH_ENTRY_LEN;
+    ProjectPatch &patch = project.patches[i];
+    uint64_t count = get_u32(entry + 4);
+
+    if (!get_string(strings, strings_size, get_u32(entry), patch.name)
+        || command + count > commands) {
+      error = wxString::Format(_("%s is damaged"), fn);
+      return false;
+    }
+
+    patch.data.resize(count);
+    const char *c = command_table + command*COMMAND_ENTRY_LEN;
+    for (size_t j = 0; j < count; j++, c += COMMAND_ENTRY_LEN) {
+      if (!PatchCommand::pack((int32_t) get_u32(c), (int32_t) get_u32(c + 4),
+            (int32_t) get_u32(c + 8), patch.data[j])) {
+        error = wxString::Format(_("%s is damaged"), fn);
+        return false;
+      }
+    }
+    command += count;
+  }
+
+  /* Rows mostly repeat a few names, intern each of them once */
+  std::unordered_map<uint32_t, Symbol> text_ids, patch_ids;
+  auto symbol = [&] (SymbolTable &symbols,
+      std::unordered_map<uint32_t, Symbol> &ids, uint32_t offset,
+      Symbol &id) {
+    auto found = ids.find(offset);
+    if (found == ids.end()) {
+      wxString name;
+      if (!get_string(strings, strings_size, offset, name)) {
+        return false;
+      }
+      found = ids.emplace(offset, symbols.intern(name)).first;
+    }
+    id = found->second;
+    return true;
+  };
+  auto loop = [&] (uint32_t value, int32_t &point) {
+    Symbol id;
+    if ((int32_t) value >= 0) {
+      point = value;
+      return true;
+    }
+    if (!symbol(text_symbols, text_ids, ~value, id)) {
+      return false;
+    }
+    point = ~(int32_t) id;
+    return true;
+  };
+
+  project.structs.resize(structs);
+  uint64_t row = 0;
+  for (uint64_t i = 0; i < structs; i++) {
+    const char *entry = struct_table + i*STRUCT_ENTRY_LEN;
+    ProjectStruct &s = project.structs[i];
+    uint64_t count = get_u32(entry + 4);
+
+    if (!get_string(strings, strings_size, get_u32(entry), s.name)
+        || row + count > rows) {
+      error = wxString::Format(_("%s is damaged"), fn);
+      return false;
+    }
+
+    s.data.resize(count);
+    const char *r = row_table + row*ROW_ENTRY_LEN;
+    for (size_t j = 0; j < count; j++, r += ROW_ENTRY_LEN) {
+      StructRow &struct_row = s.data[j];
+      struct_row.type = (StructType) (uint8_t) r[0];
+      if (struct_row.type > STRUCT_PCM
+          || !symbol(text_symbols, text_ids, get_u32(r + 1), struct_row.pcm)
+          || !symbol(patch_symbols, patch_ids, get_u32(r + 5),
+            struct_row.patch)
+          || !loop(get_u32(r + 9), struct_row.loop_start)
+          || !loop(get_u32(r + 13), struct_row.loop_end)) {
+        error = wxString::Format(_("%s is damaged"), fn);
+        return false;
+      }
+    }
+    row += count;
+  }
+
+  project.waves.resize(waves);
+  for (uint64_t i = 0; i < waves; i++) {
+    memcpy(project.waves[i].data(), wave_table + i*WAVE_SIZE, WAVE_SIZE);
+  }
+
+  return true;
+}
+
+bool ProjectFile::load(const wxString &fn, Project &project,
+    wxString &error, wxString *warning) {
+  if (warning) {
+    warning->Clear();
+  }
+  if (is_project(fn)) {
+    return read(fn, project, error);
+  }
+
+  std::multimap<wxString, wxVector<long>> patches;
+  std::multimap<wxString, wxVector<wxString>> structs;
+  if (!FileReader::read_patches_and_structs(fn, patches, structs)) {
+    error = wxString::Format(_("Failed to open %s"), fn);
+    return false;
+  }
+
+  project.patches.clear();
+  project.structs.clear();
+  project.waves.clear();
+  wxString changed;
+  for (auto &p : patches) {
+    ProjectPatch patch = {p.first, wxVector<PatchCommand>()};
+    if (!FileReader::patch_commands(p.second, patch.data)) {
+      changed += (changed.empty()? "" : ", ") + p.first;
+    }
+    project.patches.push_back(std::move(patch));
+  }
+  if (warning && !changed.empty()) {
+    *warning = wxString::Format(_("Missing or out of range values were "
+          "left out or clamped in %s"), changed);
+  }
+  for (auto &s : structs) {
+    ProjectStruct project_struct = {s.first, wxVector<StructRow>()};
+    auto &vals = s.second;
+    for (size_t i = 0; i + 4 < vals.size(); i += STRUCT_ROW_FIELDS) {
+      project_struct.data.push_back(StructRow::parse(vals[i], vals[i+1],
+            vals[i+2], vals[i+3], vals[i+4]));
+    }
+    project.structs.push_back(std::move(project_struct));
+  }
+
+  return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <wx/string.h>
+#include <wx/vector.h>
+#include "patchcommand.h"
+#include "structrow.h"
+#include "waves.h"
+
+/// File extension the editor saves projects with
+#define PROJECT_EXTENSION "upsproj"
+
+/// A patch as the editor holds it
+struct ProjectPatch {
+  wxString name;
+  wxVector<PatchCommand> data;
+};
+
+/// A PatchStruct table
+struct ProjectStruct {
+  wxString name;
+  wxVector<StructRow> data;
+};
+
+struct Project {
+  wxVector<ProjectPatch> patches;
+  wxVector<ProjectStruct> structs;
+  wxVector<WaveTable> waves;
+};
+
+/// Binary projects: everything the editor works on, in tables that load
+/// straight from a mapped file without parsing any source.
+class ProjectFile {
+public:
+    /// True if `fn` starts like a project file
+    static bool is_project(const wxString &fn);
+    /// Load a whole project.  On failure `error` says why.
+    static bool read(const wxString &fn, Project &project, wxString &error);
+    /// Load a project, or the patches and structs of a patches source file,
+    /// in which case patches come sorted by name.  Source values that don't
+    /// fit a PatchCommand are clamped, and if given `warning` names the
+    /// patches that had any, empty if none did.
+    static bool load(const wxString &fn, Project &project, wxString &error,
+        wxString *warning=nullptr);
+    /// Save a whole project, replacing `fn` only once it's complete.
+    static bool write(const wxString &fn, const Project &project);
+};
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include "rendercache.h"
+#include "waves.h"
+
+#define DEFAULT_CACHE_BUDGET (64*1024*1024)
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+RenderCache render_cache(DEFAULT_CACHE_BUDGET);
+
+RenderCache::RenderCache(size_t budget) : budget(budget), used(0) {
+}
+
+static inline void fnv_add(uint64_t &hash, uint8_t byte) {
+  hash = (hash ^ byte) * FNV_PRIME;
+}
+
+uint64_t RenderCache::hash_waves(uint32_t wave_mask,
+    const WaveTable *waves) {
+  uint64_t hash = FNV_OFFSET;
+
+  if (!waves) {
+    waves = waves_ram;
+  }
+
+  for (int w = 0; w < MAX_WAVES; w++) {
+    if (wave_mask & (1u << w)) {
+      fnv_add(hash, w);
+      for (auto s : waves[w]) {
+        fnv_add(hash, s);
+      }
+    }
+  }
+
+  return hash;
+}
+
+uint64_t RenderCache::key(const wxVector<PatchCommand> &data,
+    uint64_t waves) {
+  uint64_t hash = FNV_OFFSET;
+
+  for (auto &c : data) {
+    fnv_add(hash, c.delay);
+    fnv_add(hash, c.command);
+    fnv_add(hash, (uint16_t) c.param);
+    fnv_add(hash, (uint16_t) c.param >> 8);
+  }
+  for (int b = 0; b < 64; b += 8) {
+    fnv_add(hash, waves >> b);
+  }
+
+  return hash;
+}
+
+bool RenderCache::Entry::matches(const wxVector<PatchCommand> &data,
+    uint32_t wave_mask, const WaveTable *waves) const {
+  if (this->wave_mask != wave_mask || this->data.size() != data.size()
+      || !std::equal(data.begin(), data.end(), this->data.begin())) {
+    return false;
+  }
+
+  size_t i = 0;
+  for (int w = 0; w < MAX_WAVES; w++) {
+    if ((wave_mask & (1u << w)) && this->waves[i++] != waves[w]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+RenderBuffer RenderCache::find(uint64_t key,
+    const wxVector<PatchCommand> &data, uint32_t wave_mask,
+    const WaveTable *waves) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = index.find(key);
+  if (it == index.end()
+      || !it->second->matches(data, wave_mask, waves? waves : waves_ram)) {
+    return RenderBuffer();
+  }
+
+  /* Move to the front, it's now the most recently used */
+  entries.splice(entries.begin(), entries, it->second);
+
+  return it->second->buffer;
+}
+
+void RenderCache::insert(uint64_t key, const wxVector<PatchCommand> &data,
+    uint32_t wave_mask, const WaveTable *waves, const RenderBuffer &buffer) {
+  if (!waves) {
+    waves = waves_ram;
+  }
+  wxVector<WaveTable> tables;
+  for (int w = 0; w < MAX_WAVES; w++) {
+    if (wave_mask & (1u << w)) {
+      tables.push_back(waves[w]);
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(lock);
+  /* Replaces what was rendered from the same content, or whatever else
+   * had the same key */
+  auto it = index.find(key);
+  if (it != index.end()) {
+    used -= it->second->size();
+    entries.erase(it->second);
+    index.erase(it);
+  }
+
+  entries.push_front({key, data, wave_mask, std::move(tables), buffer});
+  index.emplace(key, entries.begin());
+  used += entries.front().size();
+
+  evict();
+}
+
+void RenderCache::clear() {
+  std::lock_guard<std::mutex> guard(lock);
+  entries.clear();
+  index.clear();
+  used = 0;
+}
+
+void RenderCache::set_budget(size_t bytes) {
+  std::lock_guard<std::mutex> guard(lock);
+  budget = bytes;
+  evict();
+}
+
+void RenderCache::evict() {
+  while (used > budget && !entries.empty()) {
+    used -= entries.back().size();
+    index.erase(entries.back().key);
+    entries.pop_back();
+  }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <wx/vector.h>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "patchcommand.h"
+#include "waves.h"
+
+/* A rendered patch, WAVE headers included. Never modified once cached */
+typedef std::shared_ptr<const wxVector<uint8_t>> RenderBuffer;
+
+/*
+ * Rendered patches shared by all PatchData, keyed by the content they were
+ * rendered from. Least recently used entries are dropped once the memory
+ * budget is exceeded. Buffers still held elsewhere (e.g. by a playing
+ * voice) stay alive after eviction. Safe to use from several threads.
+ */
+class RenderCache {
+  public:
+    RenderCache(size_t budget);
+
+    /*
+     * Hashes the contents of the wave tables selected by wave_mask, read
+     * from waves or waves_ram when it's null.
+     */
+    static uint64_t hash_waves(uint32_t wave_mask,
+        const WaveTable *waves=nullptr);
+    /* Hashes a command stream and the hash of the waves it reads */
+    static uint64_t key(const wxVector<PatchCommand> &data, uint64_t waves);
+
+    /*
+     * Entries keep the commands they were rendered from and the wave tables
+     * selected by wave_mask, read from waves or waves_ram when it's null.
+     * A key shared by two of them is a miss rather than the wrong render.
+     */
+    RenderBuffer find(uint64_t key, const wxVector<PatchCommand> &data,
+        uint32_t wave_mask, const WaveTable *waves=nullptr);
+    void insert(uint64_t key, const wxVector<PatchCommand> &data,
+        uint32_t wave_mask, const WaveTable *waves,
+        const RenderBuffer &buffer);
+    void clear();
+    void set_budget(size_t bytes);
+    size_t get_budget() const { return budget; }
+    size_t get_used() const { return used; }
+
+  private:
+    struct Entry {
+      uint64_t key;
+      wxVector<PatchCommand> data;
+      uint32_t wave_mask;
+      /* The tables of wave_mask, lowest first */
+      wxVector<WaveTable> waves;
+      RenderBuffer buffer;
+
+      size_t size() const {
+        return buffer->size() + data.size()*sizeof(PatchCommand)
+          + waves.size()*sizeof(WaveTable);
+      }
+      bool matches(const wxVector<PatchCommand> &data, uint32_t wave_mask,
+          const WaveTable *waves) const;
+    };
+    typedef std::list<Entry> EntryList;
+
+    std::mutex lock;
+    EntryList entries;
+    std::unordered_map<uint64_t, EntryList::iterator> index;
+    size_t budget;
+    size_t used;
+
+    void evict();
+};
+
+extern RenderCache render_cache;
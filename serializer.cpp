@@ -0,0 +1,144 @@
+#include <wx/file.h>
+#include <wx/filefn.h>
+#include <wx/log.h>
+#include <wx/utils.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+#include <atomic>
+#include <cstring>
+#include "serializer.h"
+
+/* Two characters per entry, indexed by the value times two */
+struct DigitTables {
+  char decimal[200];
+  char hex[512];
+
+  DigitTables() {
+    static const char digits[] = "0123456789ABCDEF";
+    for (int i = 0; i < 100; i++) {
+      decimal[i*2] = digits[i/10];
+      decimal[i*2+1] = digits[i%10];
+    }
+    for (int i = 0; i < 256; i++) {
+      hex[i*2] = digits[i >> 4];
+      hex[i*2+1] = digits[i & 15];
+    }
+  }
+};
+
+static const DigitTables tables;
+
+Serializer &Serializer::operator<<(const wxString &str) {
+  buffer += str.utf8_str();
+  return *this;
+}
+
+Serializer &Serializer::operator<<(long value) {
+  if (value < 0) {
+    buffer += '-';
+    /* Negated as unsigned so LONG_MIN doesn't overflow */
+    return *this << (0 - (unsigned long) value);
+  }
+  return *this << (unsigned long) value;
+}
+
+Serializer &Serializer::operator<<(unsigned long value) {
+  char digits[24];
+  char *p = digits + sizeof(digits);
+
+  while (value >= 100) {
+    p -= 2;
+    memcpy(p, tables.decimal + (value % 100)*2, 2);
+    value /= 100;
+  }
+  if (value >= 10) {
+    p -= 2;
+    memcpy(p, tables.decimal + value*2, 2);
+  }
+  else {
+    *--p = '0' + value;
+  }
+  buffer.append(p, digits + sizeof(digits) - p);
+
+  return *this;
+}
+
+Serializer &Serializer::hex_byte(uint8_t value) {
+  char hex[4] = {'0', 'x', tables.hex[value*2], tables.hex[value*2+1]};
+
+  buffer.append(hex, 4);
+  return *this;
+}
+
+Serializer &Serializer::bytes(const void *data, size_t count) {
+  buffer.append((const char *) data, count);
+  return *this;
+}
+
+/* Replaces to, which might exist, with from in one step */
+static bool replace_file(const wxString &from, const wxString &to) {
+#ifdef _WIN32
+  return MoveFileExW(from.wc_str(), to.wc_str(),
+      MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+  return wxRenameFile(from, to, true);
+#endif
+}
+
+/*
+ * Creates a file next to path with a name nothing else uses, like mkstemp
+ * but with the permissions new files get by default. Existing files are
+ * never opened, they could be the user's or another save's.
+ */
+static bool create_temp_file(const wxString &path, wxFile &file,
+    wxString &temp_path) {
+  static std::atomic<unsigned> counter(0);
+  /* Create() complains about existing files, they're just skipped here */
+  wxLogNull no_log;
+
+  for (int attempt = 0; attempt < 100; attempt++) {
+    temp_path = wxString::Format(wxT("%s.%lu.%u.tmp"), path,
+        wxGetProcessId(), counter++);
+    if (file.Create(temp_path, false)) {
+      return true;
+    }
+    if (!wxFileExists(temp_path)) {
+      return false;
+    }
+  }
+
+  return false;
+}
+
+bool Serializer::write(const wxString &path) const {
+  wxString temp_path;
+  wxFile file;
+
+  if (!create_temp_file(path, file, temp_path)) {
+    return false;
+  }
+
+#ifndef _WIN32
+  /* The rename replaces the file, keep who can read and write it */
+  struct stat target;
+  if (stat(path.fn_str(), &target) == 0) {
+    fchmod(file.fd(), target.st_mode & 07777);
+  }
+#endif
+
+  /* Flushed to the disk before the rename, or a crash could still leave
+   * an empty file behind */
+  bool written = file.Write(buffer.data(), buffer.size()) == buffer.size()
+    && file.Flush();
+  file.Close();
+
+  if (!written || !replace_file(temp_path, path)) {
+    wxRemoveFile(temp_path);
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <wx/string.h>
+#include <cstdint>
+#include <string>
+
+/*
+ * Formats a whole file into one buffer, then writes it in one go to a
+ * temporary file of its own next to the destination and renames it over
+ * the destination, so a failed or interrupted save leaves the old file
+ * intact. The destination keeps its permissions.
+ */
+class Serializer {
+  public:
+    void reserve(size_t bytes) { buffer.reserve(bytes); }
+    size_t size() const { return buffer.size(); }
+
+    Serializer &operator<<(const char *str) { buffer += str; return *this; }
+    Serializer &operator<<(char c) { buffer += c; return *this; }
+    Serializer &operator<<(const wxString &str);
+    Serializer &operator<<(long value);
+    Serializer &operator<<(unsigned long value);
+    Serializer &operator<<(int value) { return *this << (long) value; }
+
+    /* As 0xNN, in upper case */
+    Serializer &hex_byte(uint8_t value);
+    Serializer &bytes(const void *data, size_t count);
+
+    bool write(const wxString &path) const;
+
+  private:
+    std::string buffer;
+};
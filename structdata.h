@@ -1,7 +1,12 @@
+#pragma once
+
+#include <wx/treebase.h>
+#include "structrow.h"
+
 class StructData : public wxTreeItemData {
   public:
     StructData();
     StructData(const StructData *p);
 
-    wxVector<wxString> data;
+    wxVector<StructRow> data;
 };
@@ -0,0 +1,44 @@
+#include <algorithm>
+#include <cstdlib>
+#include "structrow.h"
+
+StructRow StructRow::parse(const wxString &type, const wxString &pcm,
+    const wxString &patch, const wxString &loop_start,
+    const wxString &loop_end) {
+  long type_number = strtol(type.c_str(), NULL, 0);
+  type_number = std::min(2l, std::max(0l, type_number));
+
+  return {(StructType) type_number, text_symbols.intern(pcm),
+    patch_symbols.intern(patch), loop_point(loop_start), loop_point(loop_end)};
+}
+
+StructRow StructRow::empty() {
+  return {STRUCT_WAVE, text_symbols.intern(wxT("NULL")),
+    patch_symbols.intern(wxT("NULL")), 0, 0};
+}
+
+bool StructRow::operator==(const StructRow &other) const {
+  return type == other.type && loop_start == other.loop_start
+    && loop_end == other.loop_end
+    && text_symbols.resolve(pcm) == text_symbols.resolve(other.pcm)
+    && patch_symbols.resolve(patch) == patch_symbols.resolve(other.patch);
+}
+
+int32_t loop_point(const wxString &text) {
+  /* Only numbers written the way loop_point_text() writes them, so the
+   * text comes back the same */
+  long value = 0;
+  bool number = !text.empty() && text.size() <= 9
+    && (text == wxT("0") || text[0] != '0');
+  for (size_t i = 0; number && i < text.size(); i++) {
+    number = text[i] >= '0' && text[i] <= '9';
+    value = value*10 + (text[i] - '0');
+  }
+
+  return number? (int32_t) value : ~(int32_t) text_symbols.intern(text);
+}
+
+wxString loop_point_text(int32_t value) {
+  return value >= 0? wxString::Format(wxT("%d"), value)
+    : text_symbols.name(~value);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <wx/string.h>
+#include <cstdint>
+#include "symboltable.h"
+
+/* Field count of a PatchStruct row as written in source */
+#define STRUCT_ROW_FIELDS 5
+
+enum StructType : uint8_t {
+  STRUCT_WAVE,
+  STRUCT_NOISE,
+  STRUCT_PCM,
+};
+
+/*
+ * One PatchStruct row. Loop points that are plain numbers are held as
+ * such, anything else (a macro, say) as ~symbol in text_symbols.
+ */
+struct StructRow {
+  StructType type;
+  Symbol pcm;           /* In text_symbols */
+  Symbol patch;         /* In patch_symbols */
+  int32_t loop_start;
+  int32_t loop_end;
+
+  /* From the fields as written in source, the type being a number */
+  static StructRow parse(const wxString &type, const wxString &pcm,
+      const wxString &patch, const wxString &loop_start,
+      const wxString &loop_end);
+  /* A row of {0, NULL, NULL, 0, 0}, what empty structs are saved as */
+  static StructRow empty();
+
+  const wxString &pcm_name() const { return text_symbols.name(pcm); }
+  const wxString &patch_name() const { return patch_symbols.name(patch); }
+
+  bool operator==(const StructRow &other) const;
+  bool operator!=(const StructRow &other) const { return !(*this == other); }
+};
+
+int32_t loop_point(const wxString &text);
+/* Gives back the exact text loop_point() was given */
+wxString loop_point_text(int32_t value);
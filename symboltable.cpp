@@ -0,0 +1,47 @@
+#include "symboltable.h"
+
+SymbolTable patch_symbols;
+SymbolTable text_symbols;
+
+Symbol SymbolTable::intern(const wxString &name) {
+  auto found = ids.find(name);
+  if (found != ids.end()) {
+    return found->second;
+  }
+
+  Symbol symbol = names.size();
+  names.push_back(name);
+  merged_into.push_back(symbol);
+  ids.emplace(name, symbol);
+  return symbol;
+}
+
+Symbol SymbolTable::find(const wxString &name) const {
+  auto found = ids.find(name);
+  return found == ids.end()? NO_SYMBOL : found->second;
+}
+
+Symbol SymbolTable::resolve(Symbol symbol) const {
+  while (merged_into[symbol] != symbol) {
+    symbol = merged_into[symbol];
+  }
+  return symbol;
+}
+
+void SymbolTable::rename(Symbol symbol, const wxString &name) {
+  symbol = resolve(symbol);
+  if (names[symbol] == name) {
+    return;
+  }
+
+  ids.erase(names[symbol]);
+  auto found = ids.find(name);
+  if (found != ids.end()) {
+    merged_into[resolve(found->second)] = symbol;
+    found->second = symbol;
+  }
+  else {
+    ids.emplace(name, symbol);
+  }
+  names[symbol] = name;
+}
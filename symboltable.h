@@ -0,0 +1,46 @@
+#pragma once
+
+#include <wx/string.h>
+#include <wx/vector.h>
+#include <cstdint>
+#include <map>
+
+typedef uint32_t Symbol;
+
+#define NO_SYMBOL ((Symbol) -1)
+
+/*
+ * Interns names so rows referring to one store a small id instead of a
+ * string. Renaming a symbol renames it everywhere it is used at once.
+ * Names are never dropped, a session only ever sees a few of them.
+ */
+class SymbolTable {
+  public:
+    Symbol intern(const wxString &name);
+    /* NO_SYMBOL if nothing has that name */
+    Symbol find(const wxString &name) const;
+    const wxString &name(Symbol symbol) const {
+      return names[resolve(symbol)];
+    }
+    /*
+     * Renamed symbols can end up merged with another one, ids of both are
+     * the same symbol once resolved
+     */
+    Symbol resolve(Symbol symbol) const;
+    /*
+     * Everything using `symbol` now reads `name`. If another symbol had
+     * that name, its uses follow `symbol` from now on.
+     */
+    void rename(Symbol symbol, const wxString &name);
+
+  private:
+    wxVector<wxString> names;
+    /* What each symbol was merged into, itself if it wasn't */
+    wxVector<Symbol> merged_into;
+    std::map<wxString, Symbol> ids;
+};
+
+/* Patch names referred to by structs, renamed along with the patches */
+extern SymbolTable patch_symbols;
+/* Other text of struct rows: PCM data pointers and non-numeric loop points */
+extern SymbolTable text_symbols;
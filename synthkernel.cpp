@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <cstring>
+#include "synthkernel.h"
+#include "waves.h"
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+  #define KERNEL_SSE2
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #include <immintrin.h>
+  #define KERNEL_AVX2 __attribute__((target("avx2")))
+#endif
+
+/* Reference scaling of a single sample, see generate_wave */
+static inline uint8_t scale_sample(int8_t sample, uint16_t vol) {
+  int16_t v16 = (int16_t) sample * vol;
+  /* Signed extention */
+  int8_t v8 = v16 / 256;
+  return (int) v8 + 128;
+}
+
+/*
+ * Scales every entry of a wave by the frame volume, so the sample loop is
+ * reduced to a table lookup.
+ */
+static void scale_table(uint8_t *lut, const uint8_t *table, uint16_t vol) {
+#ifdef KERNEL_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i v = _mm_set1_epi16(vol);
+  const __m128i sign_bit = _mm_set1_epi8((char) 0x80);
+
+  for (int i = 0; i < WAVE_SIZE; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i *) (table + i));
+    /* Sign extend to 16 bits by placing each byte in the high half */
+    __m128i lo = _mm_srai_epi16(_mm_unpacklo_epi8(zero, s), 8);
+    __m128i hi = _mm_srai_epi16(_mm_unpackhi_epi8(zero, s), 8);
+    lo = _mm_mullo_epi16(lo, v);
+    hi = _mm_mullo_epi16(hi, v);
+    /* Division by 256 rounding towards zero, like the scalar code */
+    lo = _mm_add_epi16(lo, _mm_srli_epi16(_mm_srai_epi16(lo, 15), 8));
+    hi = _mm_add_epi16(hi, _mm_srli_epi16(_mm_srai_epi16(hi, 15), 8));
+    lo = _mm_srai_epi16(lo, 8);
+    hi = _mm_srai_epi16(hi, 8);
+    __m128i out = _mm_xor_si128(_mm_packs_epi16(lo, hi), sign_bit);
+    _mm_storeu_si128((__m128i *) (lut + i), out);
+  }
+#else
+  for (int i = 0; i < WAVE_SIZE; i++) {
+    lut[i] = scale_sample(table[i], vol);
+  }
+#endif
+}
+
+static uint16_t lookup_block(uint8_t *out, size_t count, const uint8_t *lut,
+    uint16_t phase, uint16_t step) {
+  size_t j = 0;
+
+#ifdef KERNEL_SSE2
+  alignas(16) uint16_t idx[8];
+  __m128i p = _mm_setr_epi16(phase, phase + step, phase + 2*step,
+      phase + 3*step, phase + 4*step, phase + 5*step, phase + 6*step,
+      phase + 7*step);
+  const __m128i inc = _mm_set1_epi16((uint16_t) (8*step));
+
+  for (; j + 8 <= count; j += 8) {
+    _mm_store_si128((__m128i *) idx, _mm_srli_epi16(p, 8));
+    p = _mm_add_epi16(p, inc);
+    for (int k = 0; k < 8; k++) {
+      out[j+k] = lut[idx[k]];
+    }
+  }
+  phase += j*step;
+#endif
+
+  for (; j < count; j++) {
+    out[j] = lut[phase>>8];
+    phase += step;
+  }
+
+  return phase;
+}
+
+#ifdef KERNEL_AVX2
+KERNEL_AVX2
+static uint16_t lookup_block_avx2(uint8_t *out, size_t count,
+    const uint8_t *lut, uint16_t phase, uint16_t step) {
+  size_t j = 0;
+  __m256i p = _mm256_setr_epi32(phase, phase + step, phase + 2*step,
+      phase + 3*step, phase + 4*step, phase + 5*step, phase + 6*step,
+      phase + 7*step);
+  const __m256i inc = _mm256_set1_epi32(8*step);
+  const __m256i mask = _mm256_set1_epi32(0xffff);
+  /* Moves the low byte of every 32 bit lane to the bottom of its half */
+  const __m256i pick = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m256i join = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+
+  for (; j + 8 <= count; j += 8) {
+    __m256i idx = _mm256_srli_epi32(_mm256_and_si256(p, mask), 8);
+    p = _mm256_add_epi32(p, inc);
+    /* The lookup table is padded, reading 4 bytes past the last entry */
+    __m256i s = _mm256_i32gather_epi32((const int *) lut, idx, 1);
+    s = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(s, pick), join);
+    _mm_storel_epi64((__m128i *) (out + j), _mm256_castsi256_si128(s));
+  }
+  phase += j*step;
+
+  for (; j < count; j++) {
+    out[j] = lut[phase>>8];
+    phase += step;
+  }
+
+  return phase;
+}
+
+static bool has_avx2() {
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+#endif
+
+uint16_t render_wave_block(uint8_t *out, size_t count, const uint8_t *table,
+    uint16_t phase, uint16_t step, uint16_t vol) {
+  if (!vol) {
+    memset(out, 128, count);
+    return phase + count*step;
+  }
+
+  alignas(32) uint8_t lut[WAVE_SIZE+4];
+  scale_table(lut, table, vol);
+  memset(lut + WAVE_SIZE, 0, 4);
+
+#ifdef KERNEL_AVX2
+  if (has_avx2()) {
+    return lookup_block_avx2(out, count, lut, phase, step);
+  }
+#endif
+
+  return lookup_block(out, count, lut, phase, step);
+}
+
+void render_noise_block(uint8_t *out, size_t count, uint16_t &barrel,
+    int8_t &divider, uint8_t params, uint16_t vol) {
+  const uint8_t high = scale_sample(127, vol);
+  const uint8_t low = scale_sample(-128, vol);
+
+  for (size_t j = 0; j < count;) {
+    if (--divider < 0) {
+      divider = params >> 1;
+      uint8_t r_xor = (barrel ^ (barrel >> 1)) & 1;
+      barrel = (barrel >> 1) | (r_xor << (params & 1? 14 : 6));
+    }
+
+    /* The barrel holds its value until the divider runs out again */
+    size_t run = std::min(count - j, (size_t) divider + 1);
+    memset(out + j, barrel & 1? high : low, run);
+    divider -= run - 1;
+    j += run;
+  }
+}
+
+void mix_channels(uint8_t *out, const uint8_t *const *in, int channels,
+    size_t count) {
+  size_t j = 0;
+
+#ifdef KERNEL_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bias = _mm_set1_epi16(128);
+  const __m128i sign_bit = _mm_set1_epi8((char) 0x80);
+
+  for (; j + 16 <= count; j += 16) {
+    __m128i lo = zero, hi = zero;
+    for (int c = 0; c < channels; c++) {
+      __m128i s = _mm_loadu_si128((const __m128i *) (in[c] + j));
+      lo = _mm_add_epi16(lo, _mm_sub_epi16(_mm_unpacklo_epi8(s, zero), bias));
+      hi = _mm_add_epi16(hi, _mm_sub_epi16(_mm_unpackhi_epi8(s, zero), bias));
+    }
+    /* packs clips the sum to signed 8 bits, flipping the sign biases it */
+    _mm_storeu_si128((__m128i *) (out + j),
+        _mm_xor_si128(_mm_packs_epi16(lo, hi), sign_bit));
+  }
+#endif
+
+  for (; j < count; j++) {
+    int v = 0;
+    for (int c = 0; c < channels; c++) {
+      v += in[c][j] - 128;
+    }
+    out[j] = std::max(-128, std::min(127, v)) + 128;
+  }
+}
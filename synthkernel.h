@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Block kernels for the sample loop of PatchData::generate_wave. Volume and
+ * step are constant for a whole frame, so each call renders `count` samples
+ * at once. The output is bit-identical to the per-sample reference loop.
+ */
+
+/* Renders a wavetable voice, returns the phase for the next block */
+uint16_t render_wave_block(uint8_t *out, size_t count, const uint8_t *table,
+    uint16_t phase, uint16_t step, uint16_t vol);
+
+/* Renders the noise voice, advancing the LFSR barrel and divider */
+void render_noise_block(uint8_t *out, size_t count, uint16_t &barrel,
+    int8_t &divider, uint8_t params, uint16_t vol);
+
+/*
+ * Sums `channels` unsigned 8 bit buffers into out, clipping the total to 8
+ * bits. Writes silence when there are no channels.
+ */
+void mix_channels(uint8_t *out, const uint8_t *const *in, int channels,
+    size_t count);
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(size_t threads) : queued(0), pending(0),
+  next_queue(0), quit(false) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  for (size_t i = 0; i < threads; i++) {
+    queues.emplace_back(new Queue());
+  }
+  for (size_t i = 0; i < threads; i++) {
+    workers.emplace_back(&ThreadPool::run, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    quit = true;
+  }
+  wake.notify_all();
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::submit(Task task) {
+  pending++;
+  queued++;
+
+  /* Spread over the workers, stealing evens out the rest */
+  Queue &queue = *queues[next_queue++ % queues.size()];
+  {
+    std::lock_guard<std::mutex> guard(queue.lock);
+    queue.tasks.push_back(std::move(task));
+  }
+
+  /* Taking the lock makes sure a worker about to sleep sees the task */
+  {
+    std::lock_guard<std::mutex> guard(lock);
+  }
+  wake.notify_one();
+}
+
+void ThreadPool::wait() {
+  std::unique_lock<std::mutex> guard(lock);
+  idle.wait(guard, [this] { return pending == 0; });
+}
+
+bool ThreadPool::pop(size_t id, Task &task) {
+  for (size_t i = 0; i < queues.size(); i++) {
+    Queue &queue = *queues[(id + i) % queues.size()];
+    std::lock_guard<std::mutex> guard(queue.lock);
+
+    if (queue.tasks.empty()) {
+      continue;
+    }
+
+    if (i == 0) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    }
+    else {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+    queued--;
+    return true;
+  }
+
+  return false;
+}
+
+void ThreadPool::run(size_t id) {
+  for (;;) {
+    Task task;
+
+    if (pop(id, task)) {
+      task();
+      if (--pending == 0) {
+        std::lock_guard<std::mutex> guard(lock);
+        idle.notify_all();
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    if (quit && queued == 0) {
+      break;
+    }
+    wake.wait(guard, [this] { return quit || queued > 0; });
+  }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Fixed set of worker threads, each with its own task queue. Workers take
+ * the newest task of their own queue and, when it runs dry, steal the
+ * oldest one of another worker, so uneven tasks (a long patch next to a
+ * short one) don't leave cores idle.
+ */
+class ThreadPool {
+  public:
+    typedef std::function<void()> Task;
+
+    /* One worker per core when threads is 0 */
+    ThreadPool(size_t threads=0);
+    ~ThreadPool();
+
+    void submit(Task task);
+    /* Blocks until every submitted task has run */
+    void wait();
+    size_t size() const { return workers.size(); }
+
+  private:
+    struct Queue {
+      std::mutex lock;
+      std::deque<Task> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    /* Tasks waiting in a queue, and tasks not finished yet */
+    std::atomic<size_t> queued;
+    std::atomic<size_t> pending;
+    size_t next_queue;
+    bool quit;
+
+    void run(size_t id);
+    bool pop(size_t id, Task &task);
+};
@@ -0,0 +1,580 @@
+#include <wx/init.h>
+#include <wx/cmdline.h>
+#include <wx/filename.h>
+#include <wx/filefn.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <string>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#include "filereader.h"
+#include "patchprogram.h"
+#include "projectfile.h"
+#include "waves.h"
+
+/*
+ * Microbenchmarks for rendering and for the file readers and writers, run
+ * on synthetic inputs. Prints a table, or JSON to compare builds. With
+ * --check it instead checks every specialized renderer against the generic
+ * one.
+ */
+
+#define DEFAULT_MIN_TIME 0.5
+#define SMALL_SOURCE_BYTES (64*1024)
+#define LARGE_SOURCE_BYTES (2*1024*1024)
+/* Random patches checked for each built-in wave */
+#define CHECK_PATCHES 400
+/* Frames asked for by each stream call of the check */
+#define CHECK_STREAM_FRAMES 7
+
+struct BenchResult {
+  wxString name;
+  size_t iterations;
+  double seconds;     /* Per iteration */
+  double samples;     /* Rendered per iteration, 0 for file benchmarks */
+  double bytes;       /* Read or written per iteration */
+  long peak_rss;      /* Peak resident set of the process that ran it, KiB */
+};
+
+static const wxCmdLineEntryDesc cmd_line_desc[] = {
+  {wxCMD_LINE_SWITCH, "h", "help", "show this help",
+    wxCMD_LINE_VAL_NONE, wxCMD_LINE_OPTION_HELP},
+  {wxCMD_LINE_SWITCH, "j", "json", "print the results as JSON",
+    wxCMD_LINE_VAL_NONE, 0},
+  {wxCMD_LINE_SWITCH, "c", "check",
+    "check the specialized renderers against the generic one instead",
+    wxCMD_LINE_VAL_NONE, 0},
+  {wxCMD_LINE_OPTION, "t", "time",
+    "minimum time spent on each benchmark, in milliseconds",
+    wxCMD_LINE_VAL_NUMBER, 0},
+  {wxCMD_LINE_NONE, NULL, NULL, NULL, wxCMD_LINE_VAL_NONE, 0},
+};
+
+static double min_time = DEFAULT_MIN_TIME;
+
+/*
+ * Runs a benchmark in a child process where the platform has fork(), so
+ * the peak resident set reported for it is its own rather than the largest
+ * of the run so far, which is all getrusage() gives for one process.
+ * Children start as copies of this one, which only holds the names of the
+ * inputs, so the peaks of different benchmarks can be compared. Elsewhere
+ * it runs in process with no peak reported.
+ */
+static bool run_isolated(const std::function<BenchResult()> &f,
+    BenchResult &result) {
+#if defined(__unix__) || defined(__APPLE__)
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return false;
+  }
+
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    /* The numbers, then the name up to the end of the pipe */
+    BenchResult r = f();
+    double values[4] = {(double) r.iterations, r.seconds, r.samples, r.bytes};
+    std::string name = (const char *) r.name.utf8_str();
+    bool sent = write(fds[1], values, sizeof(values)) == sizeof(values)
+      && write(fds[1], name.data(), name.size()) == (ssize_t) name.size();
+    _exit(sent? 0 : 1);
+  }
+
+  close(fds[1]);
+  double values[4];
+  bool received = read(fds[0], values, sizeof(values)) == sizeof(values);
+  std::string name;
+  char buffer[256];
+  for (ssize_t got; received && (got = read(fds[0], buffer,
+          sizeof(buffer))) > 0; ) {
+    name.append(buffer, got);
+  }
+  close(fds[0]);
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status)
+      || WEXITSTATUS(status) != 0 || !received) {
+    return false;
+  }
+
+  result.name = wxString::FromUTF8(name.c_str());
+  result.iterations = values[0];
+  result.seconds = values[1];
+  result.samples = values[2];
+  result.bytes = values[3];
+#ifdef __APPLE__
+  result.peak_rss = usage.ru_maxrss/1024;
+#else
+  result.peak_rss = usage.ru_maxrss;
+#endif
+  return true;
+#else
+  result = f();
+  result.peak_rss = 0;
+  return true;
+#endif
+}
+
+/* Runs f until min_time has passed, returns the mean time per run */
+static double time_runs(const std::function<void()> &f, size_t &iterations) {
+  typedef std::chrono::steady_clock Clock;
+  auto start = Clock::now();
+  std::chrono::duration<double> elapsed(0);
+
+  iterations = 0;
+  do {
+    f();
+    iterations++;
+    elapsed = Clock::now() - start;
+  } while (elapsed.count() < min_time);
+
+  return elapsed.count()/iterations;
+}
+
+/* The patches below are written as delay, command, parameter triples */
+static wxVector<PatchCommand> pack_commands(const wxVector<long> &triples) {
+  wxVector<PatchCommand> data(triples.size()/3);
+
+  for (size_t i = 0; i < data.size(); i++) {
+    PatchCommand::pack(triples[i*3], triples[i*3+1], triples[i*3+2], data[i]);
+  }
+
+  return data;
+}
+
+/* Times what PatchData::generate_wave does: compile, allocate, render */
+static BenchResult bench_render(const wxString &name,
+    const wxVector<long> &triples) {
+  BenchResult result = {name, 0, 0, 0, 0, 0};
+  wxVector<PatchCommand> data = pack_commands(triples);
+  size_t samples = 0;
+
+  result.seconds = time_runs([&] {
+    PatchProgram program;
+    if (!program.compile(data)) {
+      fprintf(stderr, "%s: %s\n", (const char *) name.utf8_str(),
+          (const char *) program.last_error.utf8_str());
+      exit(1);
+    }
+    wxVector<uint8_t> out_data(WAVE_HEADER_LEN + program.samples());
+    program.render(&out_data[0] + WAVE_HEADER_LEN);
+    add_wave_headers(out_data);
+    samples = program.samples();
+  }, result.iterations);
+  result.samples = samples;
+
+  return result;
+}
+
+static size_t file_size(const wxString &path) {
+  wxULongLong size = wxFileName::GetSize(path);
+  return size == wxInvalidSize? 0 : (size_t) size.GetValue();
+}
+
+static BenchResult bench_file(const wxString &name, const wxString &path,
+    const std::function<void()> &f) {
+  BenchResult result = {name, 0, 0, 0, 0, 0};
+
+  result.seconds = time_runs(f, result.iterations);
+  result.bytes = file_size(path);
+
+  return result;
+}
+
+static wxVector<long> short_wave_patch() {
+  return {
+    0, PC_WAVE, 4,
+    0, PC_ENV_SPEED, -16,
+    2, PC_PITCH, 60,
+    4, PC_NOTE_UP, 12,
+    10, PC_NOTE_CUT, 0,
+  };
+}
+
+static wxVector<long> long_wave_patch() {
+  wxVector<long> data = {0, PC_WAVE, 6, 0, PC_TREMOLO_LEVEL, 64};
+
+  for (int i = 0; i < 40; i++) {
+    long row[] = {255, PC_PITCH, 40 + i, 0, PC_SLIDE, i & 1? 12 : -12};
+    data.insert(data.end(), row, row + 6);
+  }
+  long end[] = {0, PC_ENV_SPEED, -1, 0, PATCH_END, 0};
+  data.insert(data.end(), end, end + 6);
+
+  return data;
+}
+
+static wxVector<long> noise_patch() {
+  return {
+    0, PC_NOISE_PARAMS, 3,
+    0, PC_ENV_SPEED, -1,
+    120, PC_NOISE_PARAMS, 9,
+    120, PC_NOISE_PARAMS, 0x40,
+    0, PATCH_END, 0,
+  };
+}
+
+static wxVector<long> loop_patch() {
+  wxVector<long> data = {0, PC_WAVE, 2};
+
+  for (int i = 0; i < 16; i++) {
+    long loop[] = {
+      0, PC_LOOP_START, 255,
+      1, PC_NOTE_UP, 1,
+      1, PC_TREMOLO_RATE, i,
+      1, PC_NOTE_DOWN, 1,
+      0, PC_LOOP_END, 0,
+    };
+    data.insert(data.end(), loop, loop + 15);
+  }
+  long end[] = {0, PC_NOTE_CUT, 0};
+  data.insert(data.end(), end, end + 3);
+
+  return data;
+}
+
+/* Every command but the loops, with parameters compile() mostly takes */
+static wxVector<long> random_patch(unsigned &seed, long first_wave) {
+  wxVector<long> data = {0, PC_WAVE, first_wave};
+  auto next = [&] (long range) {
+    seed = seed*1103515245 + 12345;
+    return (long) ((seed >> 8) % range);
+  };
+
+  for (long rows = next(24); rows--; ) {
+    long delay = next(32);
+    long command = next(PC_SLIDE_SPEED+1);
+    long param;
+    switch (command) {
+      case PC_ENV_SPEED: param = next(41) - 20; break;
+      case PC_WAVE: param = next(DEFAULT_NUM_WAVES); break;
+      case PC_NOTE_UP:
+      case PC_NOTE_DOWN: param = next(13); break;
+      case PC_NOTE_CUT:
+      case PC_NOTE_HOLD: param = 0; break;
+      case PC_PITCH: param = 20 + next(80); break;
+      case PC_SLIDE: param = next(49) - 24; break;
+      default: param = next(256); break;
+    }
+    long row[] = {delay, command, param};
+    data.insert(data.end(), row, row + 3);
+  }
+
+  return data;
+}
+
+/* Streams the whole program a few frames at a time */
+static wxVector<uint8_t> stream_all(const PatchProgram &program,
+    const WaveTable *waves) {
+  wxVector<uint8_t> out(program.samples());
+  StreamPosition pos;
+  size_t offset = 0;
+  uint8_t chunk[CHECK_STREAM_FRAMES*SAMPLES_PER_FRAME];
+
+  for (;;) {
+    size_t frames = program.stream(chunk, CHECK_STREAM_FRAMES, pos, waves);
+    size_t samples = frames*SAMPLES_PER_FRAME;
+    if (offset + samples > out.size()) {
+      out.resize(offset + samples);
+    }
+    std::copy(chunk, chunk + samples, out.begin() + offset);
+    offset += samples;
+    if (frames < CHECK_STREAM_FRAMES) {
+      break;
+    }
+  }
+  out.resize(offset);
+
+  return out;
+}
+
+/*
+ * Renders and streams the patch with each instance that covers its
+ * features, returns how many of them differ from the generic <NOISE, true,
+ * true> render.
+ */
+static int check_patch(const wxString &name, const wxVector<long> &triples,
+    const WaveTable *waves, size_t &checked) {
+  wxVector<PatchCommand> data = pack_commands(triples);
+  PatchProgram program;
+  int failures = 0;
+
+  if (!program.compile(data)) {
+    return 0;
+  }
+  program.use_instance(program.get_features() | FEATURE_TREMOLO
+      | FEATURE_SLIDE);
+  wxVector<uint8_t> generic(program.samples());
+  if (!generic.empty()) {
+    program.render(&generic[0], waves);
+  }
+
+  for (int flags = 0; flags < 8; flags++) {
+    if (!program.use_instance(flags)) {
+      continue;
+    }
+    wxVector<uint8_t> rendered(program.samples());
+    if (!rendered.empty()) {
+      program.render(&rendered[0], waves);
+    }
+    wxVector<uint8_t> streamed = stream_all(program, waves);
+    checked++;
+
+    const char *what = rendered != generic? "render"
+      : streamed != generic? "stream" : nullptr;
+    if (what) {
+      fprintf(stderr, "%s: %s<%s, %s, %s> differs from the generic path\n",
+          (const char *) name.utf8_str(), what,
+          flags & FEATURE_NOISE? "true" : "false",
+          flags & FEATURE_TREMOLO? "true" : "false",
+          flags & FEATURE_SLIDE? "true" : "false");
+      failures++;
+    }
+  }
+
+  return failures;
+}
+
+/* Returns how many instances differ, over the patches and built-in waves */
+static int check_instances() {
+  /* Nothing has changed waves_ram, so this is the built-in waves */
+  auto waves = snapshot_waves();
+  size_t checked = 0;
+  int failures = 0;
+
+  failures += check_patch("short", short_wave_patch(), waves->data(),
+      checked);
+  failures += check_patch("long", long_wave_patch(), waves->data(),
+      checked);
+  failures += check_patch("noise", noise_patch(), waves->data(), checked);
+  failures += check_patch("loops", loop_patch(), waves->data(), checked);
+
+  unsigned seed = 1;
+  for (long wave = 0; wave < DEFAULT_NUM_WAVES; wave++) {
+    for (int i = 0; i < CHECK_PATCHES; i++) {
+      failures += check_patch(wxString::Format("wave %ld, patch %d", wave, i),
+          random_patch(seed, wave), waves->data(), checked);
+    }
+  }
+
+  printf("%zu renderer instances checked, %d differ\n", checked, failures);
+  return failures;
+}
+
+/* A patches file like the ones the editor saves, with comments thrown in */
+static bool write_patches_source(const wxString &path, size_t bytes) {
+  std::ofstream out(path.mb_str(), std::ios::out | std::ios::binary);
+  static const char *commands[] = {
+    "PC_ENV_SPEED", "PC_WAVE", "PC_NOTE_UP", "PC_NOTE_DOWN", "PC_ENV_VOL",
+    "PC_PITCH", "PC_TREMOLO_LEVEL", "PC_TREMOLO_RATE",
+  };
+  size_t patches = 0;
+
+  if (!out.is_open())
+    return false;
+
+  out << "/*\n * Generated by uzebox-patch-bench\n */\n\n";
+  for (unsigned seed = 1; (size_t) out.tellp() < bytes; patches++) {
+    out << "// Patch " << patches << "\n";
+    out << "const char patch" << patches << "[] PROGMEM ={\n";
+    for (int row = 0; row < 16; row++) {
+      seed = seed*1103515245 + 12345;
+      out << (seed >> 28) << "," << commands[(seed >> 8) % 8] << ","
+        << ((seed >> 16) & 0x3f) << ",";
+      if (row % 5 == 0)
+        out << " /* row " << row << " */";
+      out << "\n";
+    }
+    out << "0,PATCH_END\n};\n\n";
+  }
+
+  out << "const struct PatchStruct patches[] PROGMEM = {\n";
+  for (size_t i = 0; i < patches; i++) {
+    out << "  {0,NULL,patch" << i << ",0,0},\n";
+  }
+  out << "};\n";
+
+  return out.good();
+}
+
+static void print_table(const wxVector<BenchResult> &results) {
+  printf("%-32s %10s %12s %14s %10s %12s\n", "benchmark", "iterations",
+      "ms/iter", "samples/s", "MB/s", "peak RSS KiB");
+  for (auto &r : results) {
+    printf("%-32s %10zu %12.3f %14.0f %10.2f %12ld\n",
+        (const char *) r.name.utf8_str(), r.iterations, r.seconds*1000,
+        r.samples/r.seconds, r.bytes/r.seconds/(1024*1024), r.peak_rss);
+  }
+}
+
+static void print_json(const wxVector<BenchResult> &results) {
+  printf("{\n  \"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    auto &r = results[i];
+    printf("    {\"name\": \"%s\", \"iterations\": %zu, "
+        "\"seconds_per_iteration\": %.9f, \"samples_per_second\": %.1f, "
+        "\"mb_per_second\": %.3f, \"peak_rss_kib\": %ld}%s\n",
+        (const char *) r.name.utf8_str(), r.iterations, r.seconds,
+        r.samples/r.seconds, r.bytes/r.seconds/(1024*1024), r.peak_rss,
+        i+1 < results.size()? "," : "");
+  }
+  printf("  ]\n}\n");
+}
+
+int main(int argc, char **argv) {
+  wxInitializer initializer(argc, argv);
+  if (!initializer.IsOk()) {
+    fprintf(stderr, "Failed to initialize wxWidgets\n");
+    return 1;
+  }
+
+  wxCmdLineParser parser(cmd_line_desc, argc, argv);
+  if (parser.Parse() != 0) {
+    return 1;
+  }
+
+  if (parser.Found("c")) {
+    return check_instances()? 1 : 0;
+  }
+
+  long ms;
+  if (parser.Found("t", &ms)) {
+    min_time = ms/1000.0;
+  }
+
+  wxString small_path = wxFileName::CreateTempFileName("upsbench");
+  wxString large_path = wxFileName::CreateTempFileName("upsbench");
+  wxString waves_path = wxFileName::CreateTempFileName("upsbench");
+  wxString bank_path = wxFileName::CreateTempFileName("upsbench");
+  wxString project_path = wxFileName::CreateTempFileName("upsbench");
+  if (small_path.empty() || large_path.empty() || waves_path.empty()
+      || bank_path.empty() || project_path.empty()
+      || !write_patches_source(small_path, SMALL_SOURCE_BYTES)
+      || !write_patches_source(large_path, LARGE_SOURCE_BYTES)) {
+    fprintf(stderr, "Failed to write the benchmark inputs\n");
+    return 1;
+  }
+
+  /* What the benchmarks below work on, filled in by the child running them */
+  std::multimap<wxString, wxVector<long>> patches;
+  std::multimap<wxString, wxVector<wxString>> structs;
+  Project project;
+  wxString error;
+  WaveTable bank[MAX_WAVES];
+  auto load_project = [&] {
+    if (!ProjectFile::load(large_path, project, error)) {
+      fprintf(stderr, "Failed to load the benchmark project\n");
+      exit(1);
+    }
+  };
+  auto fill_bank = [&] {
+    /* A full bank of noisy waves */
+    unsigned seed = 1;
+    for (auto &wave : bank) {
+      for (auto &sample : wave) {
+        seed = seed*1103515245 + 12345;
+        sample = seed >> 24;
+      }
+    }
+  };
+
+  /* In order, the read benchmarks read what the write ones before wrote */
+  wxVector<std::function<BenchResult()>> benchmarks = {
+    [&] { return bench_render("generate_wave/short", short_wave_patch()); },
+    [&] { return bench_render("generate_wave/long", long_wave_patch()); },
+    [&] { return bench_render("generate_wave/noise", noise_patch()); },
+    [&] { return bench_render("generate_wave/loops", loop_patch()); },
+    [&] {
+      return bench_file("read_patches_and_structs/64K", small_path, [&] {
+          FileReader::read_patches_and_structs(small_path, patches,
+              structs); });
+    },
+    [&] {
+      return bench_file("read_patches_and_structs/2M/mmap", large_path, [&] {
+          FileReader::read_patches_and_structs(large_path, patches,
+              structs); });
+    },
+    /* The copy into a string the reader made before it mapped files */
+    [&] {
+      return bench_file("read_patches_and_structs/2M/copy", large_path, [&] {
+          std::ifstream in(large_path.mb_str(),
+              std::ios::in | std::ios::binary);
+          std::string src((std::istreambuf_iterator<char>(in)),
+              std::istreambuf_iterator<char>());
+          FileReader::read_patches_and_structs(src.data(),
+              src.data() + src.size(), patches, structs); });
+    },
+    [&] {
+      load_project();
+      return bench_file("write_project/2M", project_path,
+          [&] { ProjectFile::write(project_path, project); });
+    },
+    [&] {
+      return bench_file("read_project/2M", project_path,
+          [&] { ProjectFile::read(project_path, project, error); });
+    },
+    [&] {
+      fill_bank();
+      return bench_file("write_waves/32", waves_path,
+          [&] { FileReader::write_waves(waves_path, bank, MAX_WAVES); });
+    },
+    [&] {
+      return bench_file("read_waves/32", waves_path,
+          [&] { FileReader::read_waves(waves_path, bank, MAX_WAVES); });
+    },
+    [&] {
+      fill_bank();
+      return bench_file("write_wave_bank/32", bank_path,
+          [&] { FileReader::write_wave_bank(bank_path, bank, MAX_WAVES); });
+    },
+    [&] {
+      return bench_file("read_waves/bank/32", bank_path,
+          [&] { FileReader::read_waves(bank_path, bank, MAX_WAVES); });
+    },
+  };
+
+  wxVector<BenchResult> results;
+  bool failed = false;
+  for (auto &benchmark : benchmarks) {
+    BenchResult result;
+    if (!run_isolated(benchmark, result)) {
+      fprintf(stderr, "A benchmark failed to run\n");
+      failed = true;
+      break;
+    }
+    results.push_back(result);
+  }
+
+  wxRemoveFile(small_path);
+  wxRemoveFile(large_path);
+  wxRemoveFile(waves_path);
+  wxRemoveFile(bank_path);
+  wxRemoveFile(project_path);
+
+  if (failed) {
+    return 1;
+  }
+
+  if (parser.Found("j")) {
+    print_json(results);
+  }
+  else {
+    print_table(results);
+  }
+
+  return 0;
+}
@@ -0,0 +1,183 @@
+#include <wx/init.h>
+#include <wx/cmdline.h>
+#include <wx/ffile.h>
+#include <wx/filename.h>
+#include <wx/intl.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <set>
+#include "filereader.h"
+#include "patchcost.h"
+#include "patchprogram.h"
+#include "projectfile.h"
+#include "waves.h"
+
+/*
+ * Headless renderer: validates and renders every patch of a patches file to
+ * WAVE files and prints a report, without a window or an audio device.
+ */
+
+static const wxCmdLineEntryDesc cmd_line_desc[] = {
+  {wxCMD_LINE_SWITCH, "h", "help", "show this help",
+    wxCMD_LINE_VAL_NONE, wxCMD_LINE_OPTION_HELP},
+  {wxCMD_LINE_OPTION, "w", "waves", "waves file to render with",
+    wxCMD_LINE_VAL_STRING, 0},
+  {wxCMD_LINE_OPTION, "o", "output", "directory for the WAVE files",
+    wxCMD_LINE_VAL_STRING, 0},
+  {wxCMD_LINE_OPTION, "r", "report", "write the report here, not stdout",
+    wxCMD_LINE_VAL_STRING, 0},
+  {wxCMD_LINE_SWITCH, "n", "dry-run", "validate and render, write no WAVEs",
+    wxCMD_LINE_VAL_NONE, 0},
+  {wxCMD_LINE_PARAM, NULL, NULL, "patches file or project",
+    wxCMD_LINE_VAL_STRING, 0},
+  {wxCMD_LINE_NONE, NULL, NULL, NULL, wxCMD_LINE_VAL_NONE, 0},
+};
+
+/* Same naming as the editor uses for duplicated patch names */
+static wxString unique_name(const wxString &base, std::set<wxString> &used) {
+  wxString next = base;
+
+  for (int i = 0; used.count(next); i++) {
+    next = wxString::Format(wxT("%s%02d"), base, i);
+  }
+  used.insert(next);
+
+  return next;
+}
+
+static bool write_wave(const wxString &path, const wxVector<uint8_t> &data) {
+  wxFFile file(path, "wb");
+
+  return file.IsOpened() && file.Write(&data[0], data.size()) == data.size();
+}
+
+int main(int argc, char **argv) {
+  wxInitializer initializer(argc, argv);
+  if (!initializer.IsOk()) {
+    fprintf(stderr, "Failed to initialize wxWidgets\n");
+    return 1;
+  }
+
+  wxCmdLineParser parser(cmd_line_desc, argc, argv);
+  if (parser.Parse() != 0) {
+    return 1;
+  }
+
+  wxString patches_path = parser.GetParam(0);
+  wxString waves_path, output_dir = ".", report_path;
+  bool dry_run = parser.Found("n");
+  parser.Found("w", &waves_path);
+  parser.Found("o", &output_dir);
+  parser.Found("r", &report_path);
+
+  if (!waves_path.empty()) {
+    size_t loaded = FileReader::read_waves(waves_path, waves_ram, MAX_WAVES);
+    if (loaded == 0) {
+      fprintf(stderr, "%s\n", (const char *) wxString::Format(
+            _("No wave data found in %s"), waves_path).utf8_str());
+      return 1;
+    }
+
+    for (size_t i = loaded; i < DEFAULT_NUM_WAVES; i++) {
+      std::fill_n(waves_ram[i].begin(), WAVE_SIZE, 0);
+    }
+  }
+
+  Project project;
+  wxString error, warning;
+  if (!ProjectFile::load(patches_path, project, error, &warning)) {
+    fprintf(stderr, "%s\n", (const char *) error.utf8_str());
+    return 1;
+  }
+  if (!warning.empty()) {
+    fprintf(stderr, "%s\n", (const char *) warning.utf8_str());
+  }
+
+  /* Projects come with their waves, -w overrides them */
+  if (waves_path.empty() && !project.waves.empty()) {
+    std::copy(project.waves.begin(), project.waves.end(), waves_ram);
+    for (size_t i = project.waves.size(); i < DEFAULT_NUM_WAVES; i++) {
+      std::fill_n(waves_ram[i].begin(), WAVE_SIZE, 0);
+    }
+  }
+
+  if (!dry_run && !wxFileName::DirExists(output_dir)
+      && !wxFileName::Mkdir(output_dir, wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL)) {
+    fprintf(stderr, "%s\n", (const char *) wxString::Format(
+          _("Failed to create %s"), output_dir).utf8_str());
+    return 1;
+  }
+
+  FILE *report = stdout;
+  if (!report_path.empty()
+      && !(report = fopen(report_path.utf8_str(), "w"))) {
+    fprintf(stderr, "%s\n", (const char *) wxString::Format(
+          _("Failed to write to %s"), report_path).utf8_str());
+    return 1;
+  }
+
+  std::set<wxString> used_names;
+  size_t rendered = 0, failed = 0, total_samples = 0;
+  size_t patch_bytes = 0, struct_bytes = 0;
+  unsigned long peak_cycles = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  for (auto &p : project.patches) {
+    wxString name = unique_name(p.name, used_names);
+    PatchProgram program;
+    wxVector<uint8_t> wave;
+    PatchCost cost;
+    wxString error;
+
+    if (!program.compile(p.data) || !estimate_patch_cost(p.data, cost, error)) {
+      fprintf(report, "%s\tERROR\t%s\n", (const char *) name.utf8_str(),
+          (const char *) program.last_error.utf8_str());
+      failed++;
+      continue;
+    }
+
+    wave.resize(WAVE_HEADER_LEN + program.samples());
+    program.render(&wave[0] + WAVE_HEADER_LEN);
+    add_wave_headers(wave);
+
+    wxString path = wxFileName(output_dir, name + ".wav").GetFullPath();
+    if (!dry_run && !write_wave(path, wave)) {
+      fprintf(report, "%s\tERROR\t%s\n", (const char *) name.utf8_str(),
+          (const char *) wxString::Format(_("Failed to write to %s"),
+            path).utf8_str());
+      failed++;
+      continue;
+    }
+
+    fprintf(report, "%s\tOK\t%zu samples\t%.2f s\t%zu bytes\t"
+        "%lu peak cycles\t%.0f average cycles\n",
+        (const char *) name.utf8_str(), program.samples(),
+        (double) program.samples()/SAMPLE_RATE, cost.bytes, cost.peak_cycles,
+        cost.average_cycles());
+    rendered++;
+    total_samples += program.samples();
+    patch_bytes += cost.bytes;
+    peak_cycles = std::max(peak_cycles, cost.peak_cycles);
+  }
+
+  for (auto &s : project.structs) {
+    struct_bytes += struct_flash_bytes(s.data);
+  }
+
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  fprintf(report, "# %zu patches, %zu rendered, %zu failed, %zu structs\n",
+      project.patches.size(), rendered, failed, project.structs.size());
+  fprintf(report, "# %zu samples (%.2f s of audio) in %.3f s\n",
+      total_samples, (double) total_samples/SAMPLE_RATE, elapsed.count());
+  fprintf(report, "# PROGMEM %zu bytes of patches, %zu of structs; busiest "
+      "frame of a voice %lu cycles (%.2f%% of a frame)\n", patch_bytes,
+      struct_bytes, peak_cycles, 100.0*peak_cycles/CYCLES_PER_FRAME);
+
+  if (report != stdout) {
+    fclose(report);
+  }
+
+  return failed ? 2 : 0;
+}
@@ -4,62 +4,44 @@
 #endif
 #include <wx/aboutdlg.h>
 #include <wx/treectrl.h>
+#include <wx/hashmap.h>
 #include <wx/regex.h>
 #include <wx/grid.h>
 #include <wx/artprov.h>
 #include <wx/filedlg.h>
-#include <wx/textfile.h>
 #include <wx/sound.h>
 #include <wx/ffile.h>
 #include <wx/dcbuffer.h>
 #include <wx/slider.h>
 #include <wx/spinctrl.h>
+#include <wx/numdlg.h>
+#include <wx/dirdlg.h>
+#include <wx/filename.h>
+#include <wx/gauge.h>
+#include <wx/timer.h>
 #include <algorithm>
+#include <atomic>
 #include <map>
+#include <memory>
 #include <set>
+#include <unordered_map>
 #include <SDL.h>
-#include <SDL_mixer.h>
 #include <regex>
 #include "upsgrid.h"
 #include "filereader.h"
+#include "flashlayout.h"
+#include "patchcost.h"
 #include "patchdata.h"
+#include "patchgridtable.h"
+#include "patchoptimizer.h"
+#include "patchrefs.h"
+#include "projectfile.h"
 #include "structdata.h"
+#include "serializer.h"
+#include "threadpool.h"
 #include "icons.h"
 #include "waves.h"
 
-
-// define the storage that waves.h merely declared:
-WaveTable waves_ram[MAX_WAVES];
-
-// now define the (DEFAULT_NUM_WAVES)built‑in pointer table:
-const int8_t *const builtin_waves[DEFAULT_NUM_WAVES] = {
-  sine_wave,
-  up_sawtooth_wave,
-  triangle_wave,
-  square_25_wave,
-  square_50_wave,
-  square_75_wave,
-  sine_disto1_wave,
-  sine_disto2_wave,
-  sine_disto3_wave,
-  filtered_50_square_wave,
-};
-
-namespace {
-struct WavesRamInitializer {
-  WavesRamInitializer() {
-    // 1) Copy the 10 built-ins
-    for (int w = 0; w < DEFAULT_NUM_WAVES; ++w) {
-      std::copy_n(builtin_waves[w], WAVE_SIZE, waves_ram[w].begin());
-    }
-    // 2) Silence (mid‐level 128) for all the rest
-    for (int w = DEFAULT_NUM_WAVES; w < MAX_WAVES; ++w) {
-      std::fill_n(waves_ram[w].begin(), WAVE_SIZE, 128);
-    }
-  }
-} _wavesRamInit;
-}
-
 #define MIN_CLIENT_HEIGHT 400
 #define VERSION_STRING "0.0.4"
 
@@ -69,6 +51,32 @@ class UPSApp: public wxApp {
     virtual int OnExit();
 };
 
+/*
+ * A batch export of patches to WAVE files. Renders run on the pool over
+ * copies of the patches while the editor stays usable, the frame polls
+ * `done` from a timer to show progress.
+ */
+struct ExportRun {
+  struct Job {
+    wxString path;
+    wxVector<PatchCommand> data;
+    wxString error;
+  };
+
+  wxVector<Job> jobs;
+  wxString dir;
+  std::shared_ptr<const WaveBank> waves;
+  std::atomic<size_t> done{0};
+  std::atomic<bool> cancelled{false};
+  wxDialog *progress = nullptr;
+  wxGauge *gauge = nullptr;
+  /* Last, so its workers are joined before anything they use is gone */
+  ThreadPool pool;
+
+  /* Jobs still queued skip their render */
+  ~ExportRun() { cancelled = true; }
+};
+
 class UPSFrame: public wxFrame {
   public:
     UPSFrame(const wxString &title, const wxPoint &pos, const wxSize &size);
@@ -78,6 +86,8 @@ class UPSFrame: public wxFrame {
     void on_save_waves(wxCommandEvent &event);
     void on_save_waves_as(wxCommandEvent &event);
   private:
+    void save_waves_file(const wxString &path);
+    void show_waves();
     void on_new(wxCommandEvent &event);
     void on_exit(wxCommandEvent &event);
     void on_about(wxCommandEvent &event);
@@ -110,17 +120,25 @@ class UPSFrame: public wxFrame {
     void on_open_waves(wxCommandEvent &event);
     void on_sync(wxCommandEvent &event);
     void on_export(wxCommandEvent &event);
+    void on_export_all(wxCommandEvent &event);
+    void on_export_timer(wxTimerEvent &event);
+    void on_export_flash(wxCommandEvent &event);
+    void on_optimize(wxCommandEvent &event);
+    void on_costs(wxCommandEvent &event);
     void on_help_shortcuts(wxCommandEvent &event);
     void on_help_noise(wxCommandEvent &event);
     void on_import(wxCommandEvent &event);
+    void on_cache_budget(wxCommandEvent &event);
+    void on_streaming(wxCommandEvent &event);
+    void on_find_usages(wxCommandEvent &event);
+    void on_unused_patches(wxCommandEvent &event);
 
     bool validate_var_name(const wxString &name);
 
     wxString get_next_data_name(const wxString &base, bool try_bare=false);
-    wxTreeItemId find_data(const wxTreeItemId &item, const wxString &name);
-    int add_patch_command(const wxString &delay="0",
-        const wxString &command=command_choices[0],
-        const wxString &param="0",
+    wxTreeItemId find_data(const wxString &name) const;
+    wxTreeItemId append_data(const wxTreeItemId &parent, const wxString &name);
+    int add_patch_command(const PatchCommand &command={0, PC_ENV_SPEED, 0},
         int pos=-1);
     int add_struct_command(const wxString &type=_("Wave"),
         const wxString &pcm="NULL",
@@ -128,15 +146,21 @@ class UPSFrame: public wxFrame {
         const wxString &loop_start="0",
         const wxString &loop_end="0",
         int pos=-1);
-    void update_patch_data(const wxTreeItemId &item);
     void read_patch_data(const wxTreeItemId &item);
-    void update_patch_row_colors(int row);
     void save_to_file(const wxString &path);
+    void collect_project(Project &project);
+    bool write_source(const wxString &path, const Project &project,
+        const FlashLayout *layout=nullptr);
+    template <typename T>
+    void write_aliases(Serializer &file, const wxVector<T> &items,
+        const wxVector<FlashAlias> &aliases);
     void clear();
     void update_struct_row_colors(int row);
     void update_struct_data(const wxTreeItemId &item);
     void read_struct_data(const wxTreeItemId &item);
-    void replace_patch_in_structs(const wxString &src, const wxString &dst);
+    void update_struct_item_color(const wxTreeItemId &item);
+    void update_patch_users(const wxString &patch);
+    void rename_patch_in_structs(const wxString &src, const wxString &dst);
     void update_layout();
     void show_bitmap(const wxBitmap &bmp);
     void sanitize_string(wxString &str);
@@ -149,6 +173,7 @@ class UPSFrame: public wxFrame {
     wxTreeItemId data_tree_structs;
     wxTreeCtrl *data_tree;
     UPSGrid *patch_grid;
+    PatchGridTable *patch_table;
     UPSGrid *struct_grid;
 
     wxScrolledWindow *bitmap_window = nullptr;
@@ -171,6 +196,16 @@ class UPSFrame: public wxFrame {
     wxString current_file_path;
     wxString current_wave_path;
     std::set<wxString> patch_names = {wxT("NULL")};
+    /* Patches and structs by name, and the next suffix to try per base name */
+    std::unordered_map<wxString, wxTreeItemId, wxStringHash, wxStringEqual>
+      data_items;
+    std::unordered_map<wxString, int, wxStringHash, wxStringEqual>
+      next_suffixes;
+    /* Struct rows referring to each patch */
+    PatchReferences patch_refs;
+    /* The export of all patches in progress, if any */
+    std::unique_ptr<ExportRun> export_run;
+    wxTimer export_timer;
 
     static const std::map<wxString, std::pair<long, long>> limits;
     static const wxString command_choices[16];
@@ -212,7 +247,16 @@ enum {
   ID_SAVE_WAVES_AS,
   ID_TOGGLE_WAVE_EDITOR,
   ID_WAVE_COUNT,
-  ID_ZOOM_SLIDER
+  ID_ZOOM_SLIDER,
+  ID_CACHE_BUDGET,
+  ID_STREAMING,
+  ID_EXPORT_ALL,
+  ID_EXPORT_FLASH,
+  ID_OPTIMIZE,
+  ID_COSTS,
+  ID_FIND_USAGES,
+  ID_UNUSED_PATCHES,
+  ID_EXPORT_TIMER
 };
 
 wxBEGIN_EVENT_TABLE(UPSFrame, wxFrame)
@@ -249,9 +293,18 @@ wxBEGIN_EVENT_TABLE(UPSFrame, wxFrame)
   EVT_BUTTON(ID_REMOVE_DATA, UPSFrame::on_remove)
   EVT_BUTTON(ID_CLONE_DATA, UPSFrame::on_clone_data)
   EVT_MENU(ID_EXPORT, UPSFrame::on_export)
+  EVT_MENU(ID_EXPORT_ALL, UPSFrame::on_export_all)
+  EVT_MENU(ID_EXPORT_FLASH, UPSFrame::on_export_flash)
+  EVT_MENU(ID_OPTIMIZE, UPSFrame::on_optimize)
+  EVT_MENU(ID_COSTS, UPSFrame::on_costs)
+  EVT_MENU(ID_FIND_USAGES, UPSFrame::on_find_usages)
+  EVT_MENU(ID_UNUSED_PATCHES, UPSFrame::on_unused_patches)
   EVT_MENU(ID_HELP_SHORTCUTS, UPSFrame::on_help_shortcuts)
   EVT_MENU(ID_HELP_NOISE, UPSFrame::on_help_noise)
   EVT_MENU(ID_IMPORT, UPSFrame::on_import)
+  EVT_MENU(ID_CACHE_BUDGET, UPSFrame::on_cache_budget)
+  EVT_MENU(ID_STREAMING, UPSFrame::on_streaming)
+  EVT_TIMER(ID_EXPORT_TIMER, UPSFrame::on_export_timer)
   EVT_TOOL(  ID_TOGGLE_WAVE_EDITOR, UPSFrame::on_toggle_wave_editor)
   EVT_SLIDER(ID_ZOOM_SLIDER,        UPSFrame::on_zoom_slider)
 wxEND_EVENT_TABLE()
@@ -263,13 +316,18 @@ bool UPSApp::OnInit() {
   frame->SetIcon(uglyicon_xpm);
   frame->Show(true);
 
-  if (SDL_Init(SDL_INIT_AUDIO) == -1
-      || Mix_OpenAudio(SAMPLE_RATE, AUDIO_U8, 1, 4096) == -1) {
+  if (SDL_Init(SDL_INIT_AUDIO) == -1) {
     wxMessageDialog(frame, SDL_GetError(),
         _("SDL Error"), wxOK | wxICON_ERROR).ShowModal();
     return false;
   }
 
+  if (!mixer.open()) {
+    wxMessageDialog(frame, mixer.last_error,
+        _("SDL Error"), wxOK | wxICON_ERROR).ShowModal();
+    return false;
+  }
+
   if (argc > 1) {
     frame->open_file(argv[1]);
   }
@@ -278,7 +336,7 @@ bool UPSApp::OnInit() {
 }
 
 int UPSApp::OnExit() {
-  Mix_CloseAudio();
+  mixer.close();
   SDL_Quit();
 
   return 0;
@@ -356,15 +414,8 @@ const std::map<wxString, long> UPSFrame::command_ids = {
 UPSFrame::UPSFrame(const wxString &title, const wxPoint &pos,
     const wxSize &size) :
   wxFrame(NULL, wxID_ANY, title, pos, size),
-  valid_var_name("^[a-zA-Z\\_][a-zA-Z\\_0-9]*$") {
-
-  // copy all the constant waves[] into editable RAM copies:
-
-  for(int w = 0; w < DEFAULT_NUM_WAVES; ++w) {
-    for(int i = 0; i < 256; ++i)
-      ::waves_ram[w][i] = static_cast<uint8_t>(builtin_waves[w][i] + 128);
-      // (+128 to convert int8_t [-128..127] into 0..255)
-  }
+  valid_var_name("^[a-zA-Z\\_][a-zA-Z\\_0-9]*$"),
+  export_timer(this, ID_EXPORT_TIMER) {
 
   wxMenu *menuFile = new wxMenu;
   menuFile->Append(wxID_NEW, _("&New patch file"));
@@ -373,11 +424,20 @@ UPSFrame::UPSFrame(const wxString &title, const wxPoint &pos,
   menuFile->Append(wxID_SAVEAS, _("&Save patch file as.."));
   menuFile->Append(ID_IMPORT, _("&Import patch file\tCTRL+SHIFT+I"));
   menuFile->Append(ID_EXPORT, _("&Export patch to WAVE\tCTRL+SHIFT+E"));
+  menuFile->Append(ID_EXPORT_ALL, _("Export &all patches to WAVE..."));
+  menuFile->Append(ID_EXPORT_FLASH, _("Export patch file for &flash..."));
+  menuFile->Append(ID_OPTIMIZE, _("Optimi&ze patches"));
+  menuFile->Append(ID_COSTS, _("Console &costs..."));
+  menuFile->Append(ID_FIND_USAGES, _("Find patch &usages"));
+  menuFile->Append(ID_UNUSED_PATCHES, _("U&nused patches"));
   menuFile->Append(ID_OPEN_MUSIC, _("&Open music file"));
   menuFile->Append(ID_OPEN_WAVES, _("&Open waves file"));
   menuFile->Append(ID_SAVE_WAVES,    _("&Save Wave File\tCtrl+W"));
   menuFile->Append(ID_SAVE_WAVES_AS, _("Save Wave File &As...\tCtrl+Shift+W"));
   menuFile->AppendSeparator();
+  menuFile->Append(ID_CACHE_BUDGET, _("Render &cache size..."));
+  menuFile->AppendCheckItem(ID_STREAMING, _("S&tream playback"));
+  menuFile->AppendSeparator();
   menuFile->Append(wxID_EXIT);
   wxMenu *menuHelp = new wxMenu;
   menuHelp->Append(ID_HELP_SHORTCUTS, _("Keyboard Shortcuts"));
@@ -489,7 +549,8 @@ if (toolbar->FindById(ID_TOGGLE_WAVE_EDITOR)) {
   command_control_sizer->Add(new wxButton(this, ID_CLONE_COMMAND, _("Clone")));
 
   patch_grid = new UPSGrid(this, ID_PATCH_GRID);
-  patch_grid->CreateGrid(0, 3, wxGrid::wxGridSelectRows);
+  patch_table = new PatchGridTable(command_choices, command_ids, limits);
+  patch_grid->SetTable(patch_table, true, wxGrid::wxGridSelectRows);
   patch_grid->SetColLabelValue(0, _("Delay"));
   patch_grid->SetColLabelValue(1, _("Command"));
   patch_grid->SetColLabelValue(2, _("Parameter"));
@@ -500,11 +561,8 @@ if (toolbar->FindById(ID_TOGGLE_WAVE_EDITOR)) {
   patch_grid->EnableDragColMove();
 
 patch_grid->Bind(wxEVT_KILL_FOCUS, [this](wxFocusEvent& e){
-    // clear the blue selection highlight
+    // clear the blue selection highlight, the table gives the colors back
     patch_grid->ClearSelection();
-    // repaint every row so your red/green backgrounds are re‑applied
-    for(int r = 0; r < patch_grid->GetNumberRows(); ++r)
-        update_patch_row_colors(r);
     e.Skip();
 });
 
@@ -727,11 +785,8 @@ void UPSFrame::on_data_tree_changed(wxTreeEvent &event) {
 
   patch_grid->EnableEditing(false);
   struct_grid->EnableEditing(false);
+  /* Patch grid edits went straight to the old patch */
   if (old_item.IsOk()
-      && data_tree->GetItemParent(old_item) == data_tree_patches) {
-    update_patch_data(old_item);
-  }
-  else if (old_item.IsOk()
       && data_tree->GetItemParent(old_item) == data_tree_structs) {
     update_struct_data(old_item);
   }
@@ -765,8 +820,9 @@ void UPSFrame::on_data_tree_changed(wxTreeEvent &event) {
 void UPSFrame::on_new_patch(wxCommandEvent &event) {
   (void) event;
   wxString name = get_next_data_name(wxT("patch"));
-  wxTreeItemId c = data_tree->AppendItem(data_tree_patches, name);
+  wxTreeItemId c = append_data(data_tree_patches, name);
   patch_names.insert(name);
+  update_patch_users(name);
   data_tree->SetItemData(c, new PatchData());
   data_tree->SelectItem(c);
   data_tree->EditLabel(c);
@@ -775,7 +831,7 @@ void UPSFrame::on_new_patch(wxCommandEvent &event) {
 void UPSFrame::on_new_struct(wxCommandEvent &event) {
   (void) event;
   wxString name = get_next_data_name(wxT("patchstruct"));
-  wxTreeItemId c = data_tree->AppendItem(data_tree_structs, name);
+  wxTreeItemId c = append_data(data_tree_structs, name);
   data_tree->SetItemData(c, new StructData());
   data_tree->SelectItem(c);
   data_tree->EditLabel(c);
@@ -786,40 +842,29 @@ void UPSFrame::on_rename(wxCommandEvent &event) {
   data_tree->EditLabel(data_tree->GetSelection());
 }
 
-wxTreeItemId UPSFrame::find_data(const wxTreeItemId &root,
-    const wxString &name) {
-  wxTreeItemIdValue cookie;
-  auto item = data_tree->GetFirstChild(root, cookie);
-
-  while (item.IsOk()) {
-    if (data_tree->GetItemText(item) == name)
-      return item;
-
-    wxTreeItemId child = find_data(item, name);
-    if (child.IsOk())
-      return child;
-
-    item = data_tree->GetNextChild(root, cookie);
-  }
+wxTreeItemId UPSFrame::find_data(const wxString &name) const {
+  auto found = data_items.find(name);
+  return found == data_items.end()? wxTreeItemId() : found->second;
+}
 
-  return wxTreeItemId();
+wxTreeItemId UPSFrame::append_data(const wxTreeItemId &parent,
+    const wxString &name) {
+  wxTreeItemId item = data_tree->AppendItem(parent, name);
+  data_items[name] = item;
+  return item;
 }
 
 wxString UPSFrame::get_next_data_name(const wxString &base, bool try_bare) {
-  wxTreeItemId item;
   wxString next;
 
-  if (try_bare) {
-    item = find_data(data_tree_root, base);
-    if (!item.IsOk())
-      return base;
-  }
+  if (try_bare && !find_data(base).IsOk())
+    return base;
 
-  int i = 0;
+  /* Carries on from the last suffix given out, freed ones aren't reused */
+  int &i = next_suffixes[base];
   do {
     next = wxString::Format(wxT("%s%02d"), base, i++);
-    item = find_data(data_tree_root, next);
-  } while (item.IsOk());
+  } while (find_data(next).IsOk());
 
   return next;
 }
@@ -832,20 +877,24 @@ void UPSFrame::on_data_tree_label_edit_end(wxTreeEvent &event) {
     event.Veto();
     return;
   }
-  else if (find_data(data_tree_root, label).IsOk()) {
+  else if (find_data(label).IsOk()) {
     SetStatusText(_("Name already in use"));
     event.Veto();
     return;
   }
 
   auto item = event.GetItem();
+  data_items.erase(data_tree->GetItemText(item));
+  data_items[label] = item;
+
   if (data_tree->GetItemParent(item) == data_tree_patches) {
     auto old_label = data_tree->GetItemText(item);
 
     patch_names.erase(old_label);
     patch_names.insert(label);
 
-    replace_patch_in_structs(old_label, label);
+    rename_patch_in_structs(old_label, label);
+    update_patch_users(label);
   }
 }
 
@@ -853,8 +902,7 @@ bool UPSFrame::validate_var_name(const wxString &name) {
   return name != wxT("NULL") && valid_var_name.Matches(name);
 }
 
-int UPSFrame::add_patch_command(const wxString &delay, const wxString &command,
-    const wxString &param, int pos) {
+int UPSFrame::add_patch_command(const PatchCommand &command, int pos) {
   int row_num;
   if (pos == -1) {
     row_num = patch_grid->GetNumberRows();
@@ -864,15 +912,8 @@ int UPSFrame::add_patch_command(const wxString &delay, const wxString &command,
     row_num = pos;
     patch_grid->InsertRows(pos);
   }
-  patch_grid->SetCellEditor(row_num, 1, new wxGridCellChoiceEditor(16,
-        command_choices, false));
-  patch_grid->SetCellValue(delay, row_num, 0);
-  patch_grid->SetCellValue(command, row_num, 1);
-  patch_grid->SetCellValue(param, row_num, 2);
+  patch_table->set_command(row_num, command);
 
-  ////update_patch_row_colors(row_num);
-  ////patch_grid->deselect_cells();
-  update_patch_row_colors(row_num);
   // clear *all* previous selections:
   patch_grid->ClearSelection();
   // then select just our new row
@@ -926,14 +967,20 @@ void UPSFrame::on_up_command(wxCommandEvent &event) {
   for (int i = 0; i < (int) selected.GetCount(); i++) {
     int row = selected[i];
 
-    for (size_t j = 0; j < v.GetCount(); j++) {
-      v[j] = grid->GetCellValue(row, j);
+    PatchCommand command = {0, 0, 0};
+    if (grid == patch_grid) {
+      command = patch_table->get_command(row);
+    }
+    else {
+      for (size_t j = 0; j < v.GetCount(); j++) {
+        v[j] = grid->GetCellValue(row, j);
+      }
     }
 
     grid->DeleteRows(row);
     row = std::max(i, row-1);
     if (grid == patch_grid) {
-      add_patch_command(v[0], v[1], v[2], row);
+      add_patch_command(command, row);
     }
     else {
       add_struct_command(v[0], v[1], v[2], v[3], v[4], row);
@@ -963,14 +1010,20 @@ void UPSFrame::on_down_command(wxCommandEvent &event) {
   for (int i = 0; i < (int) selected.GetCount(); i++) {
     int row = selected[i];
 
-    for (size_t j = 0; j < v.GetCount(); j++) {
-      v[j] = grid->GetCellValue(row, j);
+    PatchCommand command = {0, 0, 0};
+    if (grid == patch_grid) {
+      command = patch_table->get_command(row);
+    }
+    else {
+      for (size_t j = 0; j < v.GetCount(); j++) {
+        v[j] = grid->GetCellValue(row, j);
+      }
     }
 
     grid->DeleteRows(row);
     row = std::min(last_row-i, row+1);
     if (grid == patch_grid) {
-      add_patch_command(v[0], v[1], v[2], row);
+      add_patch_command(command, row);
     }
     else {
       add_struct_command(v[0], v[1], v[2], v[3], v[4], row);
@@ -998,26 +1051,27 @@ void UPSFrame::on_clone_command(wxCommandEvent &event) {
   for (int i = 0; i < (int) selected.GetCount(); i++) {
     int row = selected[i];
 
+    if (grid == patch_grid) {
+      add_patch_command(patch_table->get_command(row));
+      continue;
+    }
+
     for (size_t j = 0; j < v.GetCount(); j++) {
       v[j] = grid->GetCellValue(row, j);
     }
 
-    if (grid == patch_grid) {
-      add_patch_command(v[0], v[1], v[2]);
-    }
-    else {
-      add_struct_command(v[0], v[1], v[2], v[3], v[4]);
-    }
+    add_struct_command(v[0], v[1], v[2], v[3], v[4]);
   }
 }
 
 void UPSFrame::on_cell_changed(wxGridEvent &event) {
   /* Patch grid is at position 1 */
   if (right_sizer->IsShown(1)) {
-    auto str = patch_grid->GetCellValue(event.GetRow(), event.GetCol());
-    sanitize_string(str);
-    patch_grid->SetCellValue(event.GetRow(), event.GetCol(), str);
-    update_patch_row_colors(event.GetRow());
+    /* The table keeps the old value of what doesn't fit in a patch */
+    if (!patch_table->last_error.IsEmpty()) {
+      SetStatusText(patch_table->last_error);
+      patch_table->last_error.Clear();
+    }
   }
   else if (right_sizer->IsShown(2)) {
     auto str = struct_grid->GetCellValue(event.GetRow(), event.GetCol());
@@ -1027,52 +1081,9 @@ void UPSFrame::on_cell_changed(wxGridEvent &event) {
   }
 }
 
-void UPSFrame::update_patch_data(const wxTreeItemId &item) {
-  auto data = (PatchData *) data_tree->GetItemData(item);
-  data->data.clear();
-
-  for (int row = 0; row < patch_grid->GetNumberRows(); row++) {
-    long delay, command, param;
-    patch_grid->GetCellValue(row, 0).ToLong(&delay);
-    command = command_ids.find(patch_grid->GetCellValue(row, 1))->second;
-    patch_grid->GetCellValue(row, 2).ToLong(&param);
-
-    data->data.push_back(delay);
-    data->data.push_back(command);
-    data->data.push_back(param);
-  }
-}
-
 void UPSFrame::read_patch_data(const wxTreeItemId &item) {
   auto data = (PatchData *) data_tree->GetItemData(item);
-
-  if (patch_grid->GetNumberRows()) {
-    patch_grid->DeleteRows(0, patch_grid->GetNumberRows());
-  }
-
-  for (size_t i = 0; i < data->data.size(); i += 3) {
-    add_patch_command(wxString::Format(wxT("%ld"), data->data[i]),
-        command_choices[std::min(15l, data->data[i+1])],
-        wxString::Format(wxT("%ld"), data->data[i+2]));
-  }
-}
-
-void UPSFrame::update_patch_row_colors(int row) {
-  long delay = strtol(patch_grid->GetCellValue(row, 0), NULL, 0);
-  long param = strtol(patch_grid->GetCellValue(row, 2), NULL, 0);
-
-  /* Delay color, always an unsigned integer */
-  patch_grid->SetCellBackgroundColour(row, 0,
-      delay < 0 || delay > 255? wxColor(127, 0, 0) : wxColour(0, 127, 0));
-
-  /* Command color is always green */
-  patch_grid->SetCellBackgroundColour(row, 1, wxColour(0, 127, 0));
-
-  /* Param limit depends on the command */
-  auto limit = limits.find(patch_grid->GetCellValue(row, 1));
-  patch_grid->SetCellBackgroundColour(row, 2,
-      param < limit->second.first || param > limit->second.second?
-      wxColor(127, 0, 0) : wxColour(0, 127, 0));
+  patch_table->set_data(&data->data);
 }
 
 void UPSFrame::on_save(wxCommandEvent &event) {
@@ -1091,7 +1102,8 @@ void UPSFrame::on_save_as(wxCommandEvent &event) {
 
   wxFileDialog file_dialog(this, _("Save"), wxEmptyString,
       current_file_path.IsEmpty()? _("patches.inc") : current_file_path,
-      wxFileSelectorDefaultWildcardStr, wxFD_SAVE | wxFD_OVERWRITE_PROMPT
+      _("Patches (*.inc)|*.inc|Projects (*.upsproj)|*.upsproj|All files|*.*"),
+      wxFD_SAVE | wxFD_OVERWRITE_PROMPT
       | wxFD_CHANGE_DIR);
 
   if (file_dialog.ShowModal() == wxID_CANCEL) {
@@ -1102,98 +1114,292 @@ void UPSFrame::on_save_as(wxCommandEvent &event) {
 }
 
 void UPSFrame::save_to_file(const wxString &path) {
-  wxTextFile file(path);
-  file.Create();
-  file.Open();
-  if (!file.IsOpened()) {
+  Project project;
+  collect_project(project);
+
+  bool saved;
+  if (wxFileName(path).GetExt().Lower() == PROJECT_EXTENSION)
+    saved = ProjectFile::write(path, project);
+  else
+    saved = write_source(path, project);
+
+  if (!saved) {
     SetStatusText(wxString::Format(_("Failed to write to %s"), path));
     return;
   }
 
+  SetStatusText(wxString::Format(_("%s written"), path));
+  current_file_path = path;
+
+  SetTitle(wxString::Format(_("Uzebox Patch Studio - %s"), current_file_path));
+}
+
+/* Everything in the editor, waves included, struct types as in source */
+void UPSFrame::collect_project(Project &project) {
   /* This forces the cell that is being edited to update its value */
   patch_grid->EnableEditing(false);
   patch_grid->EnableEditing(true);
   struct_grid->EnableEditing(false);
   struct_grid->EnableEditing(true);
 
-  file.Clear();
-
-  file.AddLine(wxString::Format("/* Created with Uzebox Patch Studio %s */",
-        VERSION_STRING));
-
-  /* Patches have to come first */
   wxTreeItemIdValue cookie;
   auto item = data_tree->GetFirstChild(data_tree_patches, cookie);
+  while (item.IsOk()) {
+    auto data = (PatchData *) data_tree->GetItemData(item);
+    project.patches.push_back({data_tree->GetItemText(item), data->data});
+
+    item = data_tree->GetNextChild(data_tree_patches, cookie);
+  }
+
+  item = data_tree->GetFirstChild(data_tree_structs, cookie);
   while (item.IsOk()) {
     if (data_tree->IsSelected(item))
-      update_patch_data(item);
+      update_struct_data(item);
 
-    file.AddLine(wxString::Format("const char %s[] PROGMEM = {",
-          data_tree->GetItemText(item)));
+    auto data = (StructData *) data_tree->GetItemData(item);
+    project.structs.push_back({data_tree->GetItemText(item), data->data});
 
-    auto data = (PatchData *) data_tree->GetItemData(item);
-    if (data->data.empty()) {
-      file.AddLine(wxT("  0, PC_PATCH_END,"));
+    item = data_tree->GetNextChild(data_tree_structs, cookie);
+  }
+
+  project.waves.assign(waves_ram, waves_ram + current_wave_count);
+}
+
+/*
+ * With a layout, patches and structs that share another one's array are
+ * defined as a pointer into it instead of getting their own.
+ */
+bool UPSFrame::write_source(const wxString &path, const Project &project,
+    const FlashLayout *layout) {
+  Serializer file;
+
+  file << "/* Created with Uzebox Patch Studio " VERSION_STRING " */\n";
+  if (layout) {
+    file << "/* " << (unsigned long) layout->shared_patches << " patches and "
+      << (unsigned long) layout->shared_structs
+      << " structs share storage, saving "
+      << (unsigned long) (layout->bytes_before - layout->bytes_after)
+      << " bytes */\n";
+  }
+
+  /* Patches have to come first */
+  for (size_t p = 0; p < project.patches.size(); p++) {
+    if (layout && layout->patches[p].base != p)
+      continue;
+
+    file << "const char " << project.patches[p].name << "[] PROGMEM = {\n";
+
+    auto &data = project.patches[p].data;
+    if (data.empty()) {
+      file << "  0, PC_PATCH_END,\n";
     }
-    for (size_t i = 0; i < data->data.size(); i += 3) {
-      if (data->data[i+1] >= 15) {
+    for (size_t i = 0; i < data.size(); i++) {
+      if (data[i].command >= 15) {
         /* This saves a byte for every patch */
-        if(i+3 >= data->data.size()) {
-          file.AddLine(wxString::Format("  %ld, PATCH_END,", data->data[i]));
+        if(i+1 >= data.size()) {
+          file << "  " << (int) data[i].delay << ", PATCH_END,\n";
         }
         else {
-          file.AddLine(wxString::Format("  %ld, PATCH_END, %ld,",
-                data->data[i], data->data[i+2]));
+          file << "  " << (int) data[i].delay << ", PATCH_END, "
+            << (int) data[i].param << ",\n";
         }
       }
       else {
-        file.AddLine(wxString::Format("  %ld, PC_%s, %ld,",
-              data->data[i], command_choices[data->data[i+1]],
-              data->data[i+2]));
+        file << "  " << (int) data[i].delay << ", PC_"
+          << command_choices[data[i].command] << ", " << (int) data[i].param
+          << ",\n";
       }
     }
 
-    file.AddLine(wxT("};"));
-
-    item = data_tree->GetNextChild(data_tree_patches, cookie);
+    file << "};\n";
+  }
+  if (layout) {
+    write_aliases(file, project.patches, layout->patches);
   }
 
   std::map<wxString, long unsigned> patch_defines;
-  item = data_tree->GetFirstChild(data_tree_structs, cookie);
-  while (item.IsOk()) {
-    if (data_tree->IsSelected(item))
-      update_struct_data(item);
+  std::set<Symbol> defined_patches;
+  for (size_t p = 0; p < project.structs.size(); p++) {
+    auto &data = project.structs[p].data;
+    for (size_t i = 0; i < data.size(); i++) {
+      if (defined_patches.insert(patch_symbols.resolve(data[i].patch)).second) {
+        patch_defines.emplace(data[i].patch_name().Upper(), i);
+      }
+    }
 
-    file.AddLine(wxString::Format("const struct PatchStruct %s[] PROGMEM = {",
-          data_tree->GetItemText(item)));
+    if (layout && layout->structs[p].base != p)
+      continue;
 
-    auto data = (StructData *) data_tree->GetItemData(item);
-    if (data->data.empty()) {
-      file.AddLine(wxT("  {0, NULL, NULL, 0, 0},"));
+    file << "const struct PatchStruct " << project.structs[p].name
+      << "[] PROGMEM = {\n";
+
+    if (data.empty()) {
+      file << "  {0, NULL, NULL, 0, 0},\n";
     }
-    for (size_t i = 0; i < data->data.size(); i += 5) {
-      file.AddLine(wxString::Format("  {%ld, %s, %s, %s, %s},",
-            choice_values.find(data->data[i])->second, data->data[i+1],
-            data->data[i+2], data->data[i+3], data->data[i+4]));
-      if (patch_defines.find(data->data[i+2].Upper()) == patch_defines.end()) {
-        patch_defines.emplace(data->data[i+2].Upper(), i/5);
-      }
+    for (auto &row : data) {
+      file << "  {" << (int) row.type << ", " << row.pcm_name() << ", "
+        << row.patch_name() << ", " << loop_point_text(row.loop_start) << ", "
+        << loop_point_text(row.loop_end) << "},\n";
     }
 
-    file.AddLine(wxT("};"));
-
-    item = data_tree->GetNextChild(data_tree_structs, cookie);
+    file << "};\n";
+  }
+  if (layout) {
+    write_aliases(file, project.structs, layout->structs);
   }
 
   for (auto &pd : patch_defines)
-    file.AddLine(wxString::Format("#define %s %lu", pd.first, pd.second));
+    file << "#define " << pd.first << ' ' << pd.second << '\n';
+
+  return file.write(path);
+}
+
+template <typename T>
+void UPSFrame::write_aliases(Serializer &file, const wxVector<T> &items,
+    const wxVector<FlashAlias> &aliases) {
+  for (size_t i = 0; i < items.size(); i++) {
+    auto &alias = aliases[i];
+    if (alias.base == i)
+      continue;
+
+    file << "#define " << items[i].name << ' ';
+    if (alias.offset)
+      file << '(' << items[alias.base].name << " + "
+        << (unsigned long) alias.offset << ")\n";
+    else
+      file << items[alias.base].name << '\n';
+  }
+}
 
-  file.Write(wxTextFileType_Unix);
+void UPSFrame::on_export_flash(wxCommandEvent &event) {
+  (void) event;
+
+  wxFileDialog file_dialog(this, _("Export for flash"), wxEmptyString,
+      _("patches.inc"), _("Patches (*.inc)|*.inc|All files|*.*"),
+      wxFD_SAVE | wxFD_OVERWRITE_PROMPT | wxFD_CHANGE_DIR);
+
+  if (file_dialog.ShowModal() == wxID_CANCEL) {
+    return;
+  }
+
+  Project project;
+  collect_project(project);
+  FlashLayout layout = plan_flash_layout(project);
+
+  wxString path = file_dialog.GetPath();
+  if (!write_source(path, project, &layout)) {
+    SetStatusText(wxString::Format(_("Failed to write to %s"), path));
+    return;
+  }
 
+  wxMessageDialog(this, wxString::Format(
+        _("%lu patches and %lu structs share storage with another one.\n"
+          "PROGMEM used: %lu bytes instead of %lu, %lu bytes saved."),
+        layout.shared_patches, layout.shared_structs, layout.bytes_after,
+        layout.bytes_before, layout.bytes_before - layout.bytes_after),
+      _("Export for flash"), wxOK | wxICON_INFORMATION).ShowModal();
   SetStatusText(wxString::Format(_("%s written"), path));
-  current_file_path = path;
+}
 
-  SetTitle(wxString::Format(_("Uzebox Patch Studio - %s"), current_file_path));
+void UPSFrame::on_optimize(wxCommandEvent &event) {
+  (void) event;
+
+  /* This forces the cell that is being edited to update its value */
+  patch_grid->EnableEditing(false);
+  patch_grid->EnableEditing(true);
+
+  size_t patches = 0, changed = 0, rows_before = 0, rows_after = 0;
+  size_t failed = 0;
+  wxString first_error;
+  wxTreeItemIdValue cookie;
+  auto item = data_tree->GetFirstChild(data_tree_patches, cookie);
+  while (item.IsOk()) {
+    bool selected = data_tree->IsSelected(item);
+
+    auto data = (PatchData *) data_tree->GetItemData(item);
+    wxVector<PatchCommand> optimized;
+    PatchOptimization result;
+    wxString error;
+    patches++;
+    if (!optimize_patch(data->data, optimized, result, error)) {
+      if (!failed++) {
+        first_error = data_tree->GetItemText(item) + ": " + error;
+      }
+    }
+    else {
+      rows_before += result.rows_before;
+      rows_after += result.rows_after;
+      if (result.rewrites) {
+        changed++;
+        data->data.swap(optimized);
+        if (selected)
+          read_patch_data(item);
+      }
+    }
+
+    item = data_tree->GetNextChild(data_tree_patches, cookie);
+  }
+
+  wxString report = wxString::Format(
+      _("%lu of %lu patches optimized, %lu commands instead of %lu.\n"
+        "Only commands the renderer acts on were changed, and every change "
+        "was checked to render the same samples."),
+      changed, patches, rows_after, rows_before);
+  if (failed) {
+    report += wxString::Format(
+        _("\n%lu patches don't compile and were left alone, the first "
+          "error was:\n%s"), failed, first_error);
+  }
+  wxMessageDialog(this, report, _("Optimize patches"),
+      wxOK | wxICON_INFORMATION).ShowModal();
+}
+
+void UPSFrame::on_costs(wxCommandEvent &event) {
+  (void) event;
+
+  Project project;
+  collect_project(project);
+
+  wxString report = wxString::Format(wxT("%-24s %6s %8s %8s %10s %10s\n"),
+      _("Patch"), _("Bytes"), _("Frames"), _("Commands"), _("Peak cyc."),
+      _("Avg. cyc."));
+  size_t patch_bytes = 0, struct_bytes = 0;
+  unsigned long peak_cycles = 0;
+  for (auto &patch : project.patches) {
+    PatchCost cost;
+    wxString error;
+    if (!estimate_patch_cost(patch.data, cost, error)) {
+      report += wxString::Format(wxT("%-24s %s\n"), patch.name, error);
+      continue;
+    }
+
+    report += wxString::Format(wxT("%-24s %6lu %8lu %8lu %10lu %10.0f\n"),
+        patch.name, cost.bytes, cost.frames, cost.commands, cost.peak_cycles,
+        cost.average_cycles());
+    patch_bytes += cost.bytes;
+    peak_cycles = std::max(peak_cycles, cost.peak_cycles);
+  }
+  for (auto &s : project.structs) {
+    struct_bytes += struct_flash_bytes(s.data);
+  }
+
+  report += wxString::Format(
+      _("\nPROGMEM: %lu bytes of patches, %lu of structs, %lu in all.\n"
+        "Busiest frame of a voice: %lu cycles, %.2f%% of a frame.\n"
+        "Cycles are estimates of the kernel's patch player, per voice."),
+      patch_bytes, struct_bytes, patch_bytes + struct_bytes, peak_cycles,
+      100.0*peak_cycles/CYCLES_PER_FRAME);
+
+  wxDialog dialog(this, wxID_ANY, _("Console costs"), wxDefaultPosition,
+      wxSize(640, 480), wxDEFAULT_DIALOG_STYLE | wxRESIZE_BORDER);
+  auto text = new wxTextCtrl(&dialog, wxID_ANY, report, wxDefaultPosition,
+      wxDefaultSize, wxTE_MULTILINE | wxTE_READONLY | wxTE_DONTWRAP);
+  text->SetFont(wxFont(wxFontInfo().Family(wxFONTFAMILY_TELETYPE)));
+  auto sizer = new wxBoxSizer(wxVERTICAL);
+  sizer->Add(text, 1, wxEXPAND | wxALL, 5);
+  sizer->Add(dialog.CreateButtonSizer(wxOK), 0, wxEXPAND | wxALL, 5);
+  dialog.SetSizer(sizer);
+  dialog.ShowModal();
 }
 
 void UPSFrame::on_open(wxCommandEvent &event) {
@@ -1210,12 +1416,14 @@ void UPSFrame::on_open(wxCommandEvent &event) {
 }
 
 void UPSFrame::open_file(const wxString &path, bool importing) {
-  std::multimap<wxString, wxVector<long>> patches;
-  std::multimap<wxString, wxVector<wxString>> structs;
-  if (!FileReader::read_patches_and_structs(path, patches, structs)) {
-    SetStatusText(wxString::Format(_("Failed to open %s"), path));
+  Project project;
+  wxString error, warning;
+  if (!ProjectFile::load(path, project, error, &warning)) {
+    SetStatusText(error);
     return;
   }
+  auto &patches = project.patches;
+  auto &structs = project.structs;
 
   if (!importing) {
     /* Clean the data */
@@ -1224,59 +1432,63 @@ void UPSFrame::open_file(const wxString &path, bool importing) {
 
   /* Add all the structs */
   wxVector<wxTreeItemId> new_structs;
+  std::set<void *> new_struct_ids;
   for (auto &s : structs) {
-    wxString name = get_next_data_name(s.first, true);
-    wxTreeItemId c = data_tree->AppendItem(data_tree_structs, name);
+    wxString name = get_next_data_name(s.name, true);
+    wxTreeItemId c = append_data(data_tree_structs, name);
     new_structs.push_back(c);
+    new_struct_ids.insert(c.GetID());
 
     StructData *data = new StructData();
-
-    for (size_t i = 0; i < s.second.size(); i += 5) {
-      long type = strtol(s.second[i].c_str(), NULL, 0);
-      type = std::min(2l, std::max(0l, type));
-      data->data.push_back(type_choices[type]);
-
-      for (size_t j = 1; j < 5; j++) {
-        data->data.push_back(s.second[i+j]);
-      }
-    }
+    data->data = s.data;
+    patch_refs.add(c, data->data);
 
     data_tree->SetItemData(c, data);
   }
 
   /* Add all the patches */
   for (auto &p : patches) {
-    wxString name = get_next_data_name(p.first, true);
-    wxTreeItemId c = data_tree->AppendItem(data_tree_patches, name);
+    wxString name = get_next_data_name(p.name, true);
+    wxTreeItemId c = append_data(data_tree_patches, name);
     patch_names.insert(name);
 
-    if (importing && p.first != name) {
-      for (auto &s : new_structs) {
-        replace_patch_in_struct(s, p.first, name);
+    if (importing && p.name != name) {
+      for (auto &use : patch_refs.structs(patch_symbols.find(p.name))) {
+        if (new_struct_ids.count(use.first.GetID()))
+          replace_patch_in_struct(use.first, p.name, name);
       }
     }
 
-    PatchData *data = new PatchData();
+    update_patch_users(name);
 
-    for (size_t i = 0; i < p.second.size(); i += 3) {
-      /* Delay */
-      data->data.push_back(p.second[i]);
-      /* Command */
-      data->data.push_back(std::min(15l, (long) p.second[i+1]));
-      /* Parameter. PATCH_END might not have one */
-      data->data.push_back(data->data.back() == 15 && i+2 >= p.second.size()?
-          0 : p.second[i+2]);
-    }
+    PatchData *data = new PatchData();
+    data->data = p.data;
 
     data_tree->SetItemData(c, data);
   }
+  for (auto &s : new_structs) {
+    update_struct_item_color(s);
+  }
 
-  SetStatusText(wxString::Format(
-        _("%s opened with %lu patches and %lu structs"),
-        path, patches.size(), structs.size()));
+  wxString status = wxString::Format(
+      _("%s opened with %lu patches and %lu structs"),
+      path, patches.size(), structs.size());
+  if (!warning.empty()) {
+    status += ". " + warning;
+  }
+  SetStatusText(status);
 
   data_tree->ExpandAll();
 
+  /* Projects come with their waves, but importing one keeps ours */
+  if (!importing && !project.waves.empty()) {
+    std::copy(project.waves.begin(), project.waves.end(), waves_ram);
+    for (size_t i = project.waves.size(); i < DEFAULT_NUM_WAVES; ++i)
+      std::fill_n(waves_ram[i].begin(), WAVE_SIZE, 0);
+    current_wave_count = int(project.waves.size());
+    show_waves();
+  }
+
   if (!importing) {
     current_file_path = path;
     SetTitle(wxString::Format(_("Uzebox Patch Studio - %s"),
@@ -1303,12 +1515,7 @@ void UPSFrame::open_waves_file(const wxString &path) {
   if (loaded == 0) {
     SetStatusText(wxString::Format(_("No wave data found in %s"), path));
   } else {
-    wave_choice->Clear();
-    for (int i = 0; i < current_wave_count; ++i)
-      wave_choice->Append(wxString::Format("Wave %d", i));
-    wave_choice->SetSelection(0);
-    wave_count_ctrl->SetValue(current_wave_count);
-    bitmap_window->Refresh();
+    show_waves();
     SetStatusText(wxString::Format(_("Loaded %zu waves from %s"), loaded, path));
   }
 
@@ -1316,16 +1523,38 @@ void UPSFrame::open_waves_file(const wxString &path) {
   current_wave_path = path;
 }
 
+/* Lists the current waves and shows the first one */
+void UPSFrame::show_waves() {
+  wave_choice->Clear();
+  for (int i = 0; i < current_wave_count; ++i)
+    wave_choice->Append(wxString::Format("Wave %d", i));
+  wave_choice->SetSelection(0);
+  wave_count_ctrl->SetValue(current_wave_count);
+  bitmap_window->Refresh();
+}
+
+/* Wave banks are saved as such, anything else as assembler source */
+void UPSFrame::save_waves_file(const wxString &path) {
+  bool saved;
+
+  if (wxFileName(path).GetExt().Lower() == WAVE_BANK_EXTENSION)
+    saved = FileReader::write_wave_bank(path, waves_ram, current_wave_count);
+  else
+    saved = FileReader::write_waves(path, waves_ram, current_wave_count);
+
+  if (saved)
+    SetStatusText(wxString::Format(_("Waves saved to %s"), path));
+  else
+    SetStatusText(wxString::Format(_("Failed to save waves to %s"), path));
+}
+
 void UPSFrame::on_save_waves(wxCommandEvent &event) {
   (void)event;
   if (current_wave_path.IsEmpty()) {
     on_save_waves_as(event);
     return;
   }
-  if (FileReader::write_waves(current_wave_path, waves_ram, current_wave_count))
-    SetStatusText(wxString::Format(_("Waves saved to %s"), current_wave_path));
-  else
-    SetStatusText(wxString::Format(_("Failed to save waves to %s"), current_wave_path));
+  save_waves_file(current_wave_path);
 }
 
 // -----------------------------------------------------------------------------
@@ -1334,16 +1563,13 @@ void UPSFrame::on_save_waves_as(wxCommandEvent &event) {
   (void)event;
   wxFileDialog dlg(this, _("Save Wave File As"), wxEmptyString,
                    current_wave_path.IsEmpty() ? _("waves.inc") : current_wave_path,
-                   wxFileSelectorDefaultWildcardStr,
+                   _("Wave files (*.inc)|*.inc|Wave banks (*.uwb)|*.uwb|All files|*.*"),
                    wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
   if (dlg.ShowModal() == wxID_CANCEL)
     return;
 
   current_wave_path = dlg.GetPath();
-  if (FileReader::write_waves(current_wave_path, waves_ram, current_wave_count))
-    SetStatusText(wxString::Format(_("Waves saved to %s"), current_wave_path));
-  else
-    SetStatusText(wxString::Format(_("Failed to save waves to %s"), current_wave_path));
+  save_waves_file(current_wave_path);
 }
 
 void UPSFrame::on_open_music(wxCommandEvent &event) {
@@ -1390,8 +1616,13 @@ void UPSFrame::on_open_waves(wxCommandEvent &event) {
 }
 
 void UPSFrame::clear() {
+  patch_table->set_data(nullptr);
   data_tree->DeleteChildren(data_tree_patches);
   data_tree->DeleteChildren(data_tree_structs);
+  data_items.clear();
+  next_suffixes.clear();
+  patch_refs.clear();
+  patch_names = {wxT("NULL")};
 
   top_sizer->Hide(1);
   update_layout();
@@ -1405,7 +1636,6 @@ void UPSFrame::on_play(wxCommandEvent &event) {
     /* Force updates */
     patch_grid->EnableEditing(false);
     patch_grid->EnableEditing(true);
-    update_patch_data(item);
 
     auto data = (PatchData *) data_tree->GetItemData(item);
     if (data->play()) {
@@ -1426,7 +1656,6 @@ void UPSFrame::on_loop(wxCommandEvent &event) {
     /* Force updates */
     patch_grid->EnableEditing(false);
     patch_grid->EnableEditing(true);
-    update_patch_data(item);
 
     auto data = (PatchData *) data_tree->GetItemData(item);
     if (data->play(true)) {
@@ -1465,7 +1694,7 @@ void UPSFrame::on_stop_all(wxCommandEvent &event) {
   }
 
   /* This causes non looping patches to stop */
-  Mix_HaltChannel(-1);
+  mixer.stop_all();
 }
 
 void UPSFrame::on_start_music(wxCommandEvent &event) {
@@ -1580,12 +1809,35 @@ void UPSFrame::update_struct_row_colors(int row) {
 
 void UPSFrame::update_struct_data(const wxTreeItemId &item) {
   auto data = (StructData *) data_tree->GetItemData(item);
+  patch_refs.remove(item, data->data);
   data->data.clear();
 
   for (int row = 0; row < struct_grid->GetNumberRows(); row++) {
-    for (int col = 0; col < 5; col++) {
-      data->data.push_back(struct_grid->GetCellValue(row, col));
-    }
+    long type = choice_values.find(struct_grid->GetCellValue(row, 0))->second;
+    data->data.push_back({(StructType) type,
+        text_symbols.intern(struct_grid->GetCellValue(row, 1)),
+        patch_symbols.intern(struct_grid->GetCellValue(row, 2)),
+        loop_point(struct_grid->GetCellValue(row, 3)),
+        loop_point(struct_grid->GetCellValue(row, 4))});
+  }
+  patch_refs.add(item, data->data);
+  update_struct_item_color(item);
+}
+
+void UPSFrame::update_struct_item_color(const wxTreeItemId &item) {
+  auto &rows = ((StructData *) data_tree->GetItemData(item))->data;
+  bool dangling = std::any_of(rows.begin(), rows.end(),
+      [&] (const StructRow &row) {
+        return patch_names.find(row.patch_name()) == patch_names.end();
+      });
+  data_tree->SetItemTextColour(item, dangling?
+      wxColour(127, 0, 0) : data_tree->GetForegroundColour());
+}
+
+/* For when a patch of that name appears or goes */
+void UPSFrame::update_patch_users(const wxString &patch) {
+  for (auto &use : patch_refs.structs(patch_symbols.find(patch))) {
+    update_struct_item_color(use.first);
   }
 }
 
@@ -1596,19 +1848,30 @@ void UPSFrame::read_struct_data(const wxTreeItemId &item) {
     struct_grid->DeleteRows(0, struct_grid->GetNumberRows());
   }
 
-  for (size_t i = 0; i < data->data.size(); i += 5) {
-    add_struct_command(data->data[i], data->data[i+1],
-        data->data[i+2], data->data[i+3], data->data[i+4]);
+  for (auto &row : data->data) {
+    add_struct_command(type_choices[row.type], row.pcm_name(),
+        row.patch_name(), loop_point_text(row.loop_start),
+        loop_point_text(row.loop_end));
   }
 }
 
-void UPSFrame::replace_patch_in_structs(const wxString &src,
+/* Rows refer to patches by symbol, so renaming the symbol renames them all */
+void UPSFrame::rename_patch_in_structs(const wxString &src,
     const wxString &dst) {
-  wxTreeItemIdValue cookie;
-  auto item = data_tree->GetFirstChild(data_tree_structs, cookie);
-  while (item.IsOk()) {
-    replace_patch_in_struct(item, src, dst);
-    item = data_tree->GetNextChild(data_tree_structs, cookie);
+  Symbol patch = patch_symbols.find(src);
+  if (patch == NO_SYMBOL) {
+    return;
+  }
+
+  /* Rows referring to the new name already now refer to the patch too */
+  Symbol taken = patch_symbols.find(dst);
+  patch = patch_symbols.resolve(patch);
+  if (taken != NO_SYMBOL) {
+    taken = patch_symbols.resolve(taken);
+  }
+  patch_symbols.rename(patch, dst);
+  if (taken != NO_SYMBOL) {
+    patch_refs.merge(taken, patch);
   }
 }
 
@@ -1621,8 +1884,32 @@ void UPSFrame::on_remove(wxCommandEvent &event) {
 
   auto parent = data_tree->GetItemParent(item);
 
-  if (parent != data_tree_root) {
-    data_tree->Delete(item);
+  if (parent == data_tree_root) {
+    return;
+  }
+
+  auto name = data_tree->GetItemText(item);
+  if (parent == data_tree_structs) {
+    patch_refs.remove(item,
+        ((StructData *) data_tree->GetItemData(item))->data);
+  }
+  else if (patch_table->get_data()
+      == &((PatchData *) data_tree->GetItemData(item))->data) {
+    patch_table->set_data(nullptr);
+  }
+  data_items.erase(name);
+  data_tree->Delete(item);
+
+  /* Structs still referring to a removed patch show in red */
+  if (parent == data_tree_patches) {
+    patch_names.erase(name);
+    update_patch_users(name);
+
+    size_t rows = patch_refs.rows(patch_symbols.find(name));
+    if (rows) {
+      SetStatusText(wxString::Format(
+            _("%lu struct rows refer to the removed patch %s"), rows, name));
+    }
   }
 }
 
@@ -1639,14 +1926,18 @@ void UPSFrame::on_clone_data(wxCommandEvent &event) {
   }
 
   auto name = get_next_data_name(data_tree->GetItemText(item));
-  auto c = data_tree->AppendItem(parent, name);
+  auto c = append_data(parent, name);
   if (parent == data_tree_patches) {
+    patch_names.insert(name);
+    update_patch_users(name);
     data_tree->SetItemData(c,
         new PatchData((PatchData *) data_tree->GetItemData(item)));
   }
   else if (parent == data_tree_structs) {
-    data_tree->SetItemData(c,
-        new StructData((StructData *) data_tree->GetItemData(item)));
+    auto data = new StructData((StructData *) data_tree->GetItemData(item));
+    data_tree->SetItemData(c, data);
+    patch_refs.add(c, data->data);
+    update_struct_item_color(c);
   }
 }
 
@@ -1700,13 +1991,140 @@ void UPSFrame::on_export(wxCommandEvent &event) {
     return;
   }
 
-  wxVector<uint8_t> wave_data;
   auto data = (PatchData *) data_tree->GetItemData(item);
-  if (!data->generate_wave(wave_data)) {
+  auto wave_data = data->render();
+  if (!wave_data) {
     SetStatusText(data->last_error);
     return;
   }
-  file.Write(&(wave_data[0]), wave_data.size());
+  file.Write(&(*wave_data)[0], wave_data->size());
+}
+
+void UPSFrame::on_export_all(wxCommandEvent &event) {
+  (void) event;
+
+  if (export_run) {
+    export_run->progress->Raise();
+    return;
+  }
+
+  wxDirDialog dir_dialog(this, _("Export all patches to"), wxEmptyString,
+      wxDD_DEFAULT_STYLE | wxDD_DIR_MUST_EXIST);
+  if (dir_dialog.ShowModal() == wxID_CANCEL) {
+    return;
+  }
+
+  /* The patch being edited may have a cell still open */
+  patch_grid->SaveEditControlValue();
+
+  std::unique_ptr<ExportRun> run(new ExportRun());
+  run->dir = dir_dialog.GetPath();
+  wxTreeItemIdValue cookie;
+  auto item = data_tree->GetFirstChild(data_tree_patches, cookie);
+  while (item.IsOk()) {
+    auto data = (PatchData *) data_tree->GetItemData(item);
+    run->jobs.push_back({wxFileName(run->dir,
+          data_tree->GetItemText(item) + ".wav").GetFullPath(), data->data,
+        wxEmptyString});
+    item = data_tree->GetNextChild(data_tree_patches, cookie);
+  }
+
+  if (run->jobs.empty()) {
+    SetStatusText(_("No patches to export"));
+    return;
+  }
+
+  run->waves = snapshot_waves();
+  ExportRun *r = run.get();
+  for (auto &job : run->jobs) {
+    ExportRun::Job *j = &job;
+    r->pool.submit([r, j] {
+      if (!r->cancelled) {
+        auto wave_data = PatchData::render(j->data, r->waves->data(),
+            j->error);
+        if (wave_data) {
+          wxFFile file(j->path, "wb");
+          if (!file.IsOpened() || file.Write(&(*wave_data)[0],
+                wave_data->size()) != wave_data->size()) {
+            j->error = wxString::Format(_("Failed to write to %s"), j->path);
+          }
+        }
+      }
+      r->done++;
+    });
+  }
+
+  /* Modeless, so the editor stays usable while the patches render */
+  r->progress = new wxDialog(this, wxID_ANY, _("Export"));
+  wxBoxSizer *sizer = new wxBoxSizer(wxVERTICAL);
+  sizer->Add(new wxStaticText(r->progress, wxID_ANY,
+        wxString::Format(_("Rendering %lu patches to %s"), r->jobs.size(),
+          r->dir)), 0, wxALL, 10);
+  r->gauge = new wxGauge(r->progress, wxID_ANY, r->jobs.size());
+  sizer->Add(r->gauge, 0, wxEXPAND | wxLEFT | wxRIGHT, 10);
+  sizer->Add(r->progress->CreateButtonSizer(wxCANCEL), 0, wxALL | wxALIGN_RIGHT,
+      10);
+  r->progress->SetSizerAndFit(sizer);
+
+  auto cancel = [r] {
+    r->cancelled = true;
+    r->progress->FindWindow(wxID_CANCEL)->Disable();
+  };
+  r->progress->Bind(wxEVT_BUTTON, [cancel](wxCommandEvent &) { cancel(); },
+      wxID_CANCEL);
+  r->progress->Bind(wxEVT_CLOSE_WINDOW, [cancel](wxCloseEvent &) {
+      cancel(); });
+  r->progress->Show();
+
+  export_run = std::move(run);
+  export_timer.Start(100);
+}
+
+void UPSFrame::on_export_timer(wxTimerEvent &event) {
+  (void) event;
+
+  if (!export_run) {
+    export_timer.Stop();
+    return;
+  }
+
+  ExportRun &run = *export_run;
+  run.gauge->SetValue(run.done);
+  if (run.done < run.jobs.size()) {
+    return;
+  }
+
+  export_timer.Stop();
+  run.pool.wait();
+  run.progress->Destroy();
+
+  size_t failed = 0;
+  wxString first_error;
+  for (auto &job : run.jobs) {
+    if (!job.error.empty() && !failed++) {
+      first_error = job.error;
+    }
+  }
+
+  /* Reported once the run is gone, the message box below runs events */
+  bool cancelled = run.cancelled;
+  size_t exported = run.jobs.size();
+  wxString dir = run.dir;
+  export_run.reset();
+
+  if (cancelled) {
+    SetStatusText(_("Export cancelled"));
+  }
+  else if (failed) {
+    wxMessageDialog(this, wxString::Format(
+          _("%lu of %lu patches failed to export, the first error was:\n%s"),
+          failed, exported, first_error), _("Export"),
+        wxOK | wxICON_WARNING).ShowModal();
+  }
+  else {
+    SetStatusText(wxString::Format(_("Exported %lu patches to %s"),
+          exported, dir));
+  }
 }
 
 void UPSFrame::on_help_shortcuts(wxCommandEvent &event) {
@@ -1748,14 +2166,109 @@ void UPSFrame::on_import(wxCommandEvent &event) {
   open_file(file_dialog.GetPath(), true);
 }
 
+void UPSFrame::on_cache_budget(wxCommandEvent &event) {
+  (void) event;
+
+  long mb = wxGetNumberFromUser(
+      _("Memory kept for rendered patches, in megabytes.\n"
+        "Unchanged patches are played without rendering them again."),
+      _("Size:"), _("Render Cache"), render_cache.get_budget() >> 20, 0,
+      4096, this);
+  if (mb < 0) {
+    return;
+  }
+
+  render_cache.set_budget((size_t) mb << 20);
+  SetStatusText(wxString::Format(_("Render cache set to %ld MB"), mb));
+}
+
+void UPSFrame::on_streaming(wxCommandEvent &event) {
+  PatchData::streaming = event.IsChecked();
+  SetStatusText(PatchData::streaming
+      ? _("Patches are rendered while they play")
+      : _("Patches are rendered before they play"));
+}
+
+void UPSFrame::on_find_usages(wxCommandEvent &event) {
+  (void) event;
+
+  auto item = data_tree->GetSelection();
+  if (!item.IsOk() || data_tree->GetItemParent(item) != data_tree_patches) {
+    SetStatusText(_("Select a patch to find the structs using it"));
+    return;
+  }
+
+  auto name = data_tree->GetItemText(item);
+  Symbol patch = patch_symbols.find(name);
+  auto users = patch_refs.structs(patch);
+  if (users.empty()) {
+    SetStatusText(wxString::Format(_("No struct refers to %s"), name));
+    return;
+  }
+
+  wxVector<wxString> lines;
+  for (auto &use : users) {
+    lines.push_back(wxString::Format(_("%s, %lu rows"),
+          data_tree->GetItemText(use.first), use.second));
+  }
+  std::sort(lines.begin(), lines.end());
+
+  wxString report = wxString::Format(_("%lu struct rows refer to %s:\n"),
+      patch_refs.rows(patch), name);
+  for (auto &line : lines) {
+    report += wxT("\n") + line;
+  }
+  wxMessageDialog(this, report, _("Patch usages"),
+      wxOK | wxICON_INFORMATION).ShowModal();
+}
+
+void UPSFrame::on_unused_patches(wxCommandEvent &event) {
+  (void) event;
+
+  /* The struct being edited counts with its latest rows */
+  auto selected = data_tree->GetSelection();
+  if (selected.IsOk()
+      && data_tree->GetItemParent(selected) == data_tree_structs) {
+    update_struct_data(selected);
+  }
+
+  wxString report;
+  size_t unused = 0;
+  wxTreeItemIdValue cookie;
+  auto item = data_tree->GetFirstChild(data_tree_patches, cookie);
+  while (item.IsOk()) {
+    auto name = data_tree->GetItemText(item);
+    if (!patch_refs.rows(patch_symbols.find(name))) {
+      report += wxT("\n") + name;
+      unused++;
+    }
+    item = data_tree->GetNextChild(data_tree_patches, cookie);
+  }
+
+  report = unused
+    ? wxString::Format(_("%lu patches no struct refers to:\n"), unused)
+      + report
+    : _("Every patch is referred to by a struct.");
+  wxMessageDialog(this, report, _("Unused patches"),
+      wxOK | wxICON_INFORMATION).ShowModal();
+}
+
 void UPSFrame::replace_patch_in_struct(const wxTreeItemId &item,
     const wxString &src, const wxString &dst) {
+  Symbol patch = patch_symbols.find(src);
+  if (patch == NO_SYMBOL) {
+    return;
+  }
+
   auto data = (StructData *) data_tree->GetItemData(item);
-  for (size_t i = 0; i < data->data.size(); i += 5) {
-    if (data->data[i+2] == src) {
-      data->data[i+2] = dst;
+  patch_refs.remove(item, data->data);
+  patch = patch_symbols.resolve(patch);
+  for (auto &row : data->data) {
+    if (patch_symbols.resolve(row.patch) == patch) {
+      row.patch = patch_symbols.intern(dst);
     }
   }
+  patch_refs.add(item, data->data);
 }
 
 void UPSFrame::on_wave_count_spin(wxSpinEvent &event) {
@@ -0,0 +1,144 @@
+#include <wx/intl.h>
+#include <algorithm>
+#include <cstring>
+#include "uzemixer.h"
+#include "synthkernel.h"
+
+#define MIXER_BUFFER_SAMPLES 1024
+
+UzeMixer mixer;
+
+UzeMixer::UzeMixer() : device(0), triggers(0) {
+  std::fill_n(triggered, MIXER_CHANNELS, 0);
+}
+
+bool UzeMixer::open() {
+  SDL_AudioSpec want, have;
+
+  SDL_zero(want);
+  want.freq = SAMPLE_RATE;
+  want.format = AUDIO_U8;
+  want.channels = 1;
+  want.samples = MIXER_BUFFER_SAMPLES;
+  want.callback = callback;
+  want.userdata = this;
+
+  /* No changes allowed, SDL converts from the console's format for us */
+  device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+  if (device == 0) {
+    last_error = wxString::Format(_("Couldn't open the audio device: %s"),
+        SDL_GetError());
+    return false;
+  }
+
+  SDL_PauseAudioDevice(device, 0);
+  return true;
+}
+
+void UzeMixer::close() {
+  if (device != 0) {
+    SDL_CloseAudioDevice(device);
+    device = 0;
+  }
+
+  for (auto &voice : voices) {
+    voice.reset();
+  }
+}
+
+int UzeMixer::allocate(bool noise) {
+  if (noise) {
+    return NOISE_CHANNEL;
+  }
+
+  SDL_LockAudioDevice(device);
+  int channel = 0;
+  for (int c = 0; c < WAVE_CHANNELS; c++) {
+    if (!voices[c]) {
+      channel = c;
+      break;
+    }
+    if (triggered[c] < triggered[channel]) {
+      channel = c;
+    }
+  }
+  SDL_UnlockAudioDevice(device);
+
+  return channel;
+}
+
+void UzeMixer::play(int channel, const std::shared_ptr<Voice> &voice) {
+  std::shared_ptr<Voice> old;
+
+  SDL_LockAudioDevice(device);
+  old.swap(voices[channel]);
+  voices[channel] = voice;
+  triggered[channel] = ++triggers;
+  SDL_UnlockAudioDevice(device);
+}
+
+void UzeMixer::stop(const std::shared_ptr<Voice> &voice) {
+  std::shared_ptr<Voice> old;
+
+  SDL_LockAudioDevice(device);
+  for (auto &v : voices) {
+    if (v == voice) {
+      old.swap(v);
+    }
+  }
+  SDL_UnlockAudioDevice(device);
+}
+
+void UzeMixer::restart(const std::shared_ptr<Voice> &voice) {
+  SDL_LockAudioDevice(device);
+  for (auto &v : voices) {
+    if (v == voice) {
+      v->restart();
+    }
+  }
+  SDL_UnlockAudioDevice(device);
+}
+
+void UzeMixer::stop_all() {
+  std::shared_ptr<Voice> old[MIXER_CHANNELS];
+
+  SDL_LockAudioDevice(device);
+  for (int c = 0; c < MIXER_CHANNELS; c++) {
+    old[c].swap(voices[c]);
+  }
+  SDL_UnlockAudioDevice(device);
+}
+
+void UzeMixer::callback(void *udata, Uint8 *stream, int len) {
+  ((UzeMixer *) udata)->mix(stream, len);
+}
+
+void UzeMixer::mix(uint8_t *out, size_t len) {
+  const uint8_t *active[MIXER_CHANNELS];
+
+  /* A frame at a time, voices render into their channel buffers */
+  while (len > 0) {
+    size_t count = std::min(len, (size_t) SAMPLES_PER_FRAME);
+    int n = 0;
+
+    for (int c = 0; c < MIXER_CHANNELS; c++) {
+      if (!voices[c]) {
+        continue;
+      }
+
+      size_t read = voices[c]->read(buffers[c], count);
+      if (read < count) {
+        memset(buffers[c] + read, 128, count - read);
+        /* Voices that aren't looping are done once they run out */
+        voices[c].reset();
+      }
+      if (read > 0) {
+        active[n++] = buffers[c];
+      }
+    }
+
+    mix_channels(out, active, n, count);
+    out += count;
+    len -= count;
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <SDL.h>
+#include <wx/string.h>
+#include <cstdint>
+#include <memory>
+#include "patchprogram.h"
+
+/* Channel layout of the Uzebox 5 channel mixer */
+#define MIXER_CHANNELS 5
+#define WAVE_CHANNELS 3
+#define NOISE_CHANNEL 3
+#define PCM_CHANNEL 4
+
+/* Something that can be played on a mixer channel */
+class Voice {
+  public:
+    virtual ~Voice() {}
+    /* Fills out with up to count samples, returns how many it wrote */
+    virtual size_t read(uint8_t *out, size_t count) = 0;
+    virtual void restart() = 0;
+};
+
+/*
+ * Models the console's sound hardware: three wave channels, a noise channel
+ * and a PCM channel mixed at SAMPLE_RATE, summed and clipped to 8 bits like
+ * the kernel does. Output goes through a single SDL audio device, SDL
+ * converts to whatever the hardware wants.
+ */
+class UzeMixer {
+  public:
+    UzeMixer();
+
+    bool open();
+    void close();
+    /*
+     * Channel for a new voice: the noise channel for noise patches, else a
+     * free wave channel or the one triggered the longest time ago.
+     */
+    int allocate(bool noise);
+    void play(int channel, const std::shared_ptr<Voice> &voice);
+    void stop(const std::shared_ptr<Voice> &voice);
+    void restart(const std::shared_ptr<Voice> &voice);
+    void stop_all();
+
+    wxString last_error;
+
+  private:
+    SDL_AudioDeviceID device;
+    std::shared_ptr<Voice> voices[MIXER_CHANNELS];
+    uint64_t triggered[MIXER_CHANNELS];
+    uint64_t triggers;
+    uint8_t buffers[MIXER_CHANNELS][SAMPLES_PER_FRAME];
+
+    static void callback(void *udata, Uint8 *stream, int len);
+    void mix(uint8_t *out, size_t len);
+};
+
+extern UzeMixer mixer;
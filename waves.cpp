@@ -0,0 +1,42 @@
+#include <algorithm>
+#include "waves.h"
+
+// define the storage that waves.h merely declared:
+WaveTable waves_ram[MAX_WAVES];
+
+// now define the (DEFAULT_NUM_WAVES)built‑in pointer table:
+const int8_t *const builtin_waves[DEFAULT_NUM_WAVES] = {
+  sine_wave,
+  up_sawtooth_wave,
+  triangle_wave,
+  square_25_wave,
+  square_50_wave,
+  square_75_wave,
+  sine_disto1_wave,
+  sine_disto2_wave,
+  sine_disto3_wave,
+  filtered_50_square_wave,
+};
+
+namespace {
+struct WavesRamInitializer {
+  WavesRamInitializer() {
+    // 1) Copy the 10 built-ins
+    // (+128 to convert int8_t [-128..127] into 0..255)
+    for (int w = 0; w < DEFAULT_NUM_WAVES; ++w) {
+      for (int i = 0; i < WAVE_SIZE; ++i)
+        waves_ram[w][i] = static_cast<uint8_t>(builtin_waves[w][i] + 128);
+    }
+    // 2) Silence (mid‐level 128) for all the rest
+    for (int w = DEFAULT_NUM_WAVES; w < MAX_WAVES; ++w) {
+      std::fill_n(waves_ram[w].begin(), WAVE_SIZE, 128);
+    }
+  }
+} _wavesRamInit;
+}
+
+std::shared_ptr<const WaveBank> snapshot_waves() {
+  auto bank = std::make_shared<WaveBank>();
+  std::copy(waves_ram, waves_ram + MAX_WAVES, bank->begin());
+  return bank;
+}
@@ -2,6 +2,7 @@
 
 #include <array>
 #include <cstdint>
+#include <memory>
 
 // how many built-in waves you ship with:
 static const int DEFAULT_NUM_WAVES = 10;
@@ -11,6 +12,8 @@ static const int MAX_WAVES         = 32;
 static const int WAVE_SIZE         = 256;
 
 using WaveTable = std::array<uint8_t, WAVE_SIZE>;
+/// every table, e.g. a snapshot of waves_ram taken for background renders
+using WaveBank  = std::array<WaveTable, MAX_WAVES>;
 
 
 static const int8_t sine_wave[] = {
@@ -220,3 +223,6 @@ static const int8_t filtered_50_square_wave[] = {
 
 extern WaveTable           waves_ram[MAX_WAVES];
 extern const int8_t *const builtin_waves[DEFAULT_NUM_WAVES];
+
+/// immutable copy of waves_ram, safe to read from any thread
+std::shared_ptr<const WaveBank> snapshot_waves();